@@ -366,10 +366,11 @@ def __init__(
             except Exception:
                 self.misc_config_errors.append(f'Invalid listen_on={args.listen_on}, ignoring')
                 log_error(self.misc_config_errors[-1])
+        self.pty_record_to = open(args.record_pty, 'wb') if args.record_pty else None
         self.child_monitor = ChildMonitor(
             self.on_child_death,
             DumpCommands(args) if args.dump_commands or args.dump_bytes else None,
-            talk_fd, listen_fd,
+            talk_fd, listen_fd, -1 if self.pty_record_to is None else self.pty_record_to.fileno(),
         )
         set_boss(self)
         self.args = args
@@ -1809,7 +1810,10 @@ def notify_on_os_window_death(self, address: str) -> None:
                 s.shutdown(socket.SHUT_RDWR)
             s.close()
 
-    def display_scrollback(self, window: Window, data: Union[bytes, str], input_line_number: int = 0, title: str = '', report_cursor: bool = True) -> None:
+    def display_scrollback(
+        self, window: Window, data: Union[bytes, str, int],  # an int is a file descriptor with the data, that is closed after use
+        input_line_number: int = 0, title: str = '', report_cursor: bool = True
+    ) -> None:
 
         def prepare_arg(x: str) -> str:
             x = x.replace('INPUT_LINE_NUMBER', str(input_line_number))
@@ -1824,7 +1828,10 @@ def prepare_arg(x: str) -> str:
         if os.path.basename(cmd[0]) == 'less':
             cmd.append('-+F')  # reset --quit-if-one-screen
         tab = self.active_tab
-        if tab is not None:
+        if tab is None:
+            if isinstance(data, int):
+                os.close(data)
+        else:
             bdata = data.encode('utf-8') if isinstance(data, str) else data
             if is_macos and cmd[0] == '/usr/bin/less' and macos_version()[:2] < (12, 3):
                 # the system less before macOS 12.3 barfs up OSC codes, so sanitize them ourselves
@@ -1833,6 +1840,9 @@ def prepare_arg(x: str) -> str:
                     if less_version(cmd[0]) >= 581:
                         open(sentinel, 'w').close()
                     else:
+                        if isinstance(bdata, int):
+                            with open(bdata, 'rb') as f:
+                                bdata = f.read()
                         bdata = re.sub(br'\x1b\].*?\x1b\\', b'', bdata)
 
             tab.new_special_window(
@@ -2131,6 +2141,9 @@ def destroy(self) -> None:
         self.set_update_check_process()
         self.update_check_process = None
         del self.child_monitor
+        if self.pty_record_to is not None:
+            self.pty_record_to.close()
+            self.pty_record_to = None
         for tm in self.os_window_map.values():
             tm.destroy()
         self.os_window_map = {}
@@ -16,12 +16,17 @@
 #include <termios.h>
 #include <unistd.h>
 #include <float.h>
+#include <math.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <signal.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#define USE_EPOLL
+#endif
 extern PyTypeObject Screen_Type;
 
 #if defined(__APPLE__) || defined(__OpenBSD__)
@@ -71,6 +76,7 @@ typedef struct {
     int fd;
     unsigned long id;
     pid_t pid;
+    short io_events;  // the events the I/O thread is currently waiting for on fd
 } Child;
 
 static const Child EMPTY_CHILD = {0};
@@ -86,10 +92,33 @@ static Child children[MAX_CHILDREN] = {{0}};
 static Child scratch[MAX_CHILDREN] = {{0}};
 static Child add_queue[MAX_CHILDREN] = {{0}}, remove_queue[MAX_CHILDREN] = {{0}}, remove_notify[MAX_CHILDREN] = {{0}};
 static size_t add_queue_count = 0, remove_queue_count = 0;
-static struct pollfd children_fds[MAX_CHILDREN + EXTRA_FDS] = {{0}};
 static pthread_mutex_t children_lock, talk_lock;
+// The events waited for on a child fd only change when its read buffer fills
+// up or is drained, or when data is queued for writing to it. With epoll each
+// fd is registered once, so the cost of a wakeup is proportional to the
+// number of ready fds rather than the number of children.
+#ifdef USE_EPOLL
+static int epoll_fd = -1;
+static struct epoll_event ready_events[MAX_CHILDREN + EXTRA_FDS];
+static ssize_t *fd_to_child = NULL;  // index into children, only used in the I/O thread
+static size_t fd_to_child_sz = 0;
+#else
+static struct pollfd children_fds[MAX_CHILDREN + EXTRA_FDS] = {{0}};
+#endif
+// fds of children not waiting for POLLIN because their read buffer is full, only used in the I/O thread
+static int read_starved_fds[MAX_CHILDREN];
+static size_t read_starved_count = 0;
+// fds of children with data queued for writing, protected by children_lock
+static int write_pending_fds[MAX_CHILDREN];
+static size_t write_pending_count = 0;
+static bool write_pending_overflow = false;
 static bool kill_signal_received = false, reload_config_signal_received = false;
 static ChildMonitor *the_monitor = NULL;
+// PTY recording: owned by the I/O thread once the ChildMonitor is created
+static int pty_record_fd = -1;
+static monotonic_t pty_record_last_at = 0;
+#define PTY_RECORD_MAGIC "KPTYREC\x01"
+static void stop_parse_pool(void);
 
 typedef struct {
     pid_t pid;
@@ -103,6 +132,19 @@ static size_t reaped_pids_count = 0;
 
 
 
+static bool
+write_all(int fd, const uint8_t *data, size_t sz) {
+    while (sz) {
+        ssize_t n = write(fd, data, sz);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return false;
+        }
+        data += n; sz -= n;
+    }
+    return true;
+}
+
 // Main thread functions {{{
 
 #define FREE_CHILD(x) \
@@ -159,11 +201,18 @@ static PyObject *
 new(PyTypeObject *type, PyObject *args, PyObject UNUSED *kwds) {
     ChildMonitor *self;
     PyObject *dump_callback, *death_notify;
-    int talk_fd = -1, listen_fd = -1;
+    int talk_fd = -1, listen_fd = -1, record_fd = -1;
     int ret;
 
     if (the_monitor) { PyErr_SetString(PyExc_RuntimeError, "Can have only a single ChildMonitor instance"); return NULL; }
-    if (!PyArg_ParseTuple(args, "OO|ii", &death_notify, &dump_callback, &talk_fd, &listen_fd)) return NULL;
+    if (!PyArg_ParseTuple(args, "OO|iii", &death_notify, &dump_callback, &talk_fd, &listen_fd, &record_fd)) return NULL;
+    if (record_fd > -1) {
+        // The header is written here, before the I/O thread exists, so that
+        // the file is valid even if no child ever produces output
+        static const char magic[] = PTY_RECORD_MAGIC;
+        if (!write_all(record_fd, (const uint8_t*)magic, sizeof(magic) - 1)) return PyErr_SetFromErrno(PyExc_OSError);
+        pty_record_fd = record_fd; pty_record_last_at = monotonic();
+    }
     if ((ret = pthread_mutex_init(&children_lock, NULL)) != 0) {
         PyErr_Format(PyExc_RuntimeError, "Failed to create children_lock mutex: %s", strerror(ret));
         return NULL;
@@ -183,8 +232,17 @@ new(PyTypeObject *type, PyObject *args, PyObject UNUSED *kwds) {
         parse_func = parse_worker_dump;
     } else parse_func = parse_worker;
     self->count = 0;
+#ifdef USE_EPOLL
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) return PyErr_SetFromErrno(PyExc_OSError);
+    const int extra_fds[EXTRA_FDS] = {self->io_loop_data.wakeup_read_fd, self->io_loop_data.signal_read_fd};
+    for (size_t i = 0; i < arraysz(extra_fds); i++) {
+        struct epoll_event ev = {.events = EPOLLIN, .data.fd = extra_fds[i]};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, extra_fds[i], &ev) != 0) return PyErr_SetFromErrno(PyExc_OSError);
+    }
+#else
     children_fds[0].fd = self->io_loop_data.wakeup_read_fd; children_fds[1].fd = self->io_loop_data.signal_read_fd;
-    children_fds[0].events = POLLIN; children_fds[1].events = POLLIN; children_fds[2].events = POLLIN;
+    children_fds[0].events = POLLIN; children_fds[1].events = POLLIN;
+#endif
     the_monitor = self;
 
     return (PyObject*) self;
@@ -210,6 +268,10 @@ dealloc(ChildMonitor* self) {
         FREE_CHILD(add_queue[add_queue_count]);
     }
     free_loop_data(&self->io_loop_data);
+#ifdef USE_EPOLL
+    if (epoll_fd > -1) { safe_close(epoll_fd, __FILE__, __LINE__); epoll_fd = -1; }
+    free(fd_to_child); fd_to_child = NULL; fd_to_child_sz = 0;
+#endif
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
@@ -323,6 +385,14 @@ add_child(ChildMonitor *self, PyObject *args) {
     Py_RETURN_NONE;
 }
 
+static void
+queue_write_interest(int fd) {
+    // Must be called with children_lock held
+    for (size_t i = 0; i < write_pending_count; i++) { if (write_pending_fds[i] == fd) return; }
+    if (write_pending_count < arraysz(write_pending_fds)) write_pending_fds[write_pending_count++] = fd;
+    else write_pending_overflow = true;
+}
+
 #define schedule_write_to_child_generic(id, num, va_start, get_next_arg, va_end) \
     ChildMonitor *self = the_monitor; \
     bool found = false; \
@@ -363,7 +433,7 @@ add_child(ChildMonitor *self, PyObject *args) {
                 screen->write_buf = PyMem_RawRealloc(screen->write_buf, screen->write_buf_sz); \
                 if (screen->write_buf == NULL) { fatal("Out of memory."); } \
             } \
-            if (screen->write_buf_used) wakeup_io_loop(self, false); \
+            if (screen->write_buf_used) { queue_write_interest(children[i].fd); wakeup_io_loop(self, false); } \
             screen_mutex(unlock, write); \
             break; \
         } \
@@ -429,6 +499,7 @@ shutdown_monitor(ChildMonitor *self, PyObject *a UNUSED) {
     wakeup_io_loop(self, false);
     int ret = pthread_join(self->io_thread, NULL);
     if (ret != 0) return PyErr_Format(PyExc_OSError, "Failed to join() I/O thread with error: %s", strerror(ret));
+    stop_parse_pool();
     if (talk_thread_started) {
         ret = pthread_join(self->talk_thread, NULL);
         if (ret != 0) return PyErr_Format(PyExc_OSError, "Failed to join() talk thread with error: %s", strerror(ret));
@@ -437,27 +508,172 @@ shutdown_monitor(ChildMonitor *self, PyObject *a UNUSED) {
     Py_RETURN_NONE;
 }
 
+static bool
+input_ready_to_parse(Screen *screen, monotonic_t now, bool flush) {
+    const size_t available = atomic_load_explicit(&screen->read_buf_head, memory_order_acquire) - atomic_load_explicit(&screen->read_buf_tail, memory_order_relaxed);
+    if (!available && !screen->pending_mode.used) return false;
+    monotonic_t time_since_new_input = now - atomic_load_explicit(&screen->new_input_at, memory_order_relaxed);
+    const monotonic_t input_delay = atomic_load_explicit(&screen->input_delay, memory_order_relaxed);
+    // Dont let a large backlog wait, the I/O thread may run out of space to read into
+    // read_buf_sz can be safely used here as the buffer is not empty
+    if (flush || time_since_new_input >= input_delay || (available && available >= screen->read_buf_sz / 2)) {
+        // Reset before parsing so that input arriving during the parse
+        // starts a new delay rather than being lost
+        atomic_store_explicit(&screen->new_input_at, 0, memory_order_relaxed);
+        return true;
+    }
+    set_maximum_wait(input_delay - time_since_new_input);
+    return false;
+}
+
+static void
+input_parsed(ChildMonitor *self, Screen *screen, monotonic_t now) {
+    // Ensure the I/O thread resumes reading if it stopped because read_buf was full,
+    // see read_buf_is_starved() for the other half of this handshake
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&screen->read_buf_starved, false)) wakeup_io_loop(self, false);
+    if (screen->pending_mode.activated_at) {
+        monotonic_t time_since_pending = MAX(0, now - screen->pending_mode.activated_at);
+        set_maximum_wait(screen->pending_mode.wait_time - time_since_pending);
+    }
+}
+
 static bool
 do_parse(ChildMonitor *self, Screen *screen, monotonic_t now, bool flush) {
+    if (!input_ready_to_parse(screen, now, flush)) return false;
+    parse_func(screen, self->dump_callback, now);
+    input_parsed(self, screen, now);
+    return true;
+}
+
+// Parallel parsing {{{
+// Screens whose pending input can be parsed without calling into Python are
+// parsed concurrently on a small pool of worker threads, with the main thread
+// taking part. Screens whose input needs Python are parsed on the main thread
+// afterwards, so no Python code ever runs while a worker is using a screen.
+
+#define MAX_PARSE_WORKERS 8
+// Below this there is more to be lost than gained by handing a screen to another thread
+#define MIN_BYTES_FOR_PARALLEL_PARSE (16u * 1024u)
+
+typedef struct {
+    Screen *screen;
+    size_t head;
+} ParseJob;
+
+static struct {
+    pthread_t threads[MAX_PARSE_WORKERS];
+    unsigned num_threads;
+    bool initialized, shutting_down;
+    pthread_mutex_t lock;
+    pthread_cond_t work_available, work_done;
+    ParseJob jobs[MAX_CHILDREN];
+    size_t num_jobs, next_job, jobs_done;
+    monotonic_t now;
+} parse_pool = {0};
+
+static bool
+run_next_parse_job(void) {
+    // Must be called with parse_pool.lock held, returns with it held
+    if (parse_pool.next_job >= parse_pool.num_jobs) return false;
+    ParseJob job = parse_pool.jobs[parse_pool.next_job++];
+    pthread_mutex_unlock(&parse_pool.lock);
+    parse_worker_until(job.screen, job.head, parse_pool.now);
+    pthread_mutex_lock(&parse_pool.lock);
+    if (++parse_pool.jobs_done == parse_pool.num_jobs) pthread_cond_signal(&parse_pool.work_done);
+    return true;
+}
+
+static void*
+parse_pool_worker(void *data UNUSED) {
+    set_thread_name("KittyParser");
+    pthread_mutex_lock(&parse_pool.lock);
+    while (!parse_pool.shutting_down) {
+        if (!run_next_parse_job()) pthread_cond_wait(&parse_pool.work_available, &parse_pool.lock);
+    }
+    pthread_mutex_unlock(&parse_pool.lock);
+    return NULL;
+}
+
+static bool
+start_parse_pool(void) {
+    if (parse_pool.initialized) return parse_pool.num_threads > 0;
+    parse_pool.initialized = true;
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus < 2) return false;
+    if (pthread_mutex_init(&parse_pool.lock, NULL) != 0 || pthread_cond_init(&parse_pool.work_available, NULL) != 0 || pthread_cond_init(&parse_pool.work_done, NULL) != 0) {
+        log_error("Failed to initialize the parser thread pool, parsing on the main thread only");
+        return false;
+    }
+    for (unsigned i = 0; i < MIN((unsigned long)num_cpus - 1, (unsigned long)MAX_PARSE_WORKERS); i++) {
+        int ret = pthread_create(parse_pool.threads + i, NULL, parse_pool_worker, NULL);
+        if (ret != 0) { log_error("Failed to start parser thread with error: %s", strerror(ret)); break; }
+        parse_pool.num_threads++;
+    }
+    return parse_pool.num_threads > 0;
+}
+
+static void
+stop_parse_pool(void) {
+    if (!parse_pool.num_threads) return;
+    pthread_mutex_lock(&parse_pool.lock);
+    parse_pool.shutting_down = true;
+    pthread_cond_broadcast(&parse_pool.work_available);
+    pthread_mutex_unlock(&parse_pool.lock);
+    for (unsigned i = 0; i < parse_pool.num_threads; i++) pthread_join(parse_pool.threads[i], NULL);
+    parse_pool.num_threads = 0;
+}
+
+static void
+run_parse_jobs(size_t num_jobs, monotonic_t now) {
+    pthread_mutex_lock(&parse_pool.lock);
+    parse_pool.num_jobs = num_jobs; parse_pool.next_job = 0; parse_pool.jobs_done = 0; parse_pool.now = now;
+    pthread_cond_broadcast(&parse_pool.work_available);
+    while (run_next_parse_job());
+    while (parse_pool.jobs_done < parse_pool.num_jobs) pthread_cond_wait(&parse_pool.work_done, &parse_pool.lock);
+    parse_pool.num_jobs = 0;
+    pthread_mutex_unlock(&parse_pool.lock);
+}
+
+static bool
+parse_children(ChildMonitor *self, Child *children_to_parse, size_t count, monotonic_t now) {
     bool input_read = false;
-    screen_mutex(lock, read);
-    if (screen->read_buf_sz || screen->pending_mode.used) {
-        monotonic_t time_since_new_input = now - screen->new_input_at;
-        if (flush || time_since_new_input >= OPT(input_delay)) {
-            bool read_buf_full = screen->read_buf_sz >= READ_BUF_SZ;
-            input_read = true;
-            parse_func(screen, self->dump_callback, now);
-            if (read_buf_full) wakeup_io_loop(self, false);  // Ensure the read fd has POLLIN set
-            screen->new_input_at = 0;
-            if (screen->pending_mode.activated_at) {
-                monotonic_t time_since_pending = MAX(0, now - screen->pending_mode.activated_at);
-                set_maximum_wait(screen->pending_mode.wait_time - time_since_pending);
+    size_t num_jobs = 0;
+    if (!self->dump_callback && count > 1) {
+        for (size_t i = 0; i < count; i++) {
+            Screen *screen = children_to_parse[i].screen;
+            const size_t available = atomic_load_explicit(&screen->read_buf_head, memory_order_relaxed) - atomic_load_explicit(&screen->read_buf_tail, memory_order_relaxed);
+            size_t head;
+            if (!children_to_parse[i].needs_removal && available >= MIN_BYTES_FOR_PARALLEL_PARSE && parse_worker_is_python_free(screen, &head)) {
+                parse_pool.jobs[num_jobs++] = (ParseJob){.screen=screen, .head=head};
+            }
+        }
+        if (num_jobs < 2 || !start_parse_pool()) num_jobs = 0;
+        else {
+            for (size_t j = 0; j < num_jobs; j++) {
+                if (input_ready_to_parse(parse_pool.jobs[j].screen, now, false)) continue;
+                parse_pool.jobs[j--] = parse_pool.jobs[--num_jobs];  // still waiting for input_delay
             }
-        } else set_maximum_wait(OPT(input_delay) - time_since_new_input);
+            run_parse_jobs(num_jobs, now);
+            for (size_t j = 0; j < num_jobs; j++) input_parsed(self, parse_pool.jobs[j].screen, now);
+            input_read = num_jobs > 0;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        // anything not parsed in parallel, including any input that arrived while the workers were running
+        if (children_to_parse[i].needs_removal) continue;
+        Screen *screen = children_to_parse[i].screen;
+        if (do_parse(self, screen, now, false)) input_read = true;
+        else if (atomic_load_explicit(&screen->read_buf_head, memory_order_relaxed) == atomic_load_explicit(&screen->read_buf_tail, memory_order_relaxed)) {
+            // the child is idle, a good time to convert the lines it scrolled off the top of the scrollback
+            // and to compress the scrollback it is no longer using
+            const bool converting = historybuf_convert_pending_pagerhist(screen->historybuf);
+            if (historybuf_compress_cold_segments(screen->historybuf) || converting) set_maximum_wait(ms_to_monotonic_t(50ll));
+        }
     }
-    screen_mutex(unlock, read);
     return input_read;
 }
+// }}}
 
 static bool
 parse_input(ChildMonitor *self) {
@@ -537,12 +753,8 @@ parse_input(ChildMonitor *self) {
         FREE_CHILD(remove_notify[remove_count]);
     }
 
-    for (size_t i = 0; i < count; i++) {
-        if (!scratch[i].needs_removal) {
-            if (do_parse(self, scratch[i].screen, now, false)) input_read = true;
-        }
-        DECREF_CHILD(scratch[i]);
-    }
+    if (parse_children(self, scratch, count, now)) input_read = true;
+    for (size_t i = 0; i < count; i++) DECREF_CHILD(scratch[i]);
     if (reload_config_called) {
         call_boss(load_config_file, "");
     }
@@ -647,7 +859,7 @@ pyset_iutf8(ChildMonitor *self, PyObject *args) {
     for (size_t i = 0; i < self->count; i++) {
         if (children[i].id == window_id) {
             found = Py_True;
-            if (!set_iutf8(children_fds[EXTRA_FDS + i].fd, on & 1)) PyErr_SetFromErrno(PyExc_OSError);
+            if (!set_iutf8(children[i].fd, on & 1)) PyErr_SetFromErrno(PyExc_OSError);
             break;
         }
     }
@@ -776,6 +988,10 @@ prepare_to_render_os_window(OSWindow *os_window, monotonic_t now, unsigned int *
             if (WD.screen->start_visual_bell_at != 0) needs_render = true;
         }
     }
+    // glyphs rasterized on other threads are uploaded here, after the cells that use them
+    bool has_pending_sprites;
+    if (send_rasterized_sprites(os_window->fonts_data, &has_pending_sprites)) needs_render = true;
+    if (has_pending_sprites) set_maximum_wait(OPT(repaint_delay));
     return needs_render;
 }
 
@@ -1281,14 +1497,109 @@ main_loop(ChildMonitor *self, PyObject *a UNUSED) {
 
 // I/O thread functions {{{
 
+#ifdef USE_EPOLL
+static uint32_t
+as_epoll_events(short events) {
+    return (events & POLLIN ? EPOLLIN : 0) | (events & POLLOUT ? EPOLLOUT : 0);
+}
+
+static void
+map_fd_to_child(int fd, ssize_t idx) {
+    if ((size_t)fd >= fd_to_child_sz) {
+        size_t sz = MAX(64u, MAX(2 * fd_to_child_sz, (size_t)fd + 1));
+        fd_to_child = realloc(fd_to_child, sz * sizeof(fd_to_child[0]));
+        if (!fd_to_child) fatal("Out of memory");
+        for (size_t i = fd_to_child_sz; i < sz; i++) fd_to_child[i] = -1;
+        fd_to_child_sz = sz;
+    }
+    fd_to_child[fd] = idx;
+}
+#endif
+
+static ssize_t
+child_index_for_fd(ChildMonitor *self UNUSED, int fd) {
+#ifdef USE_EPOLL
+    return (size_t)fd < fd_to_child_sz ? fd_to_child[fd] : -1;
+#else
+    for (size_t i = 0; i < self->count; i++) { if (children[i].fd == fd) return i; }
+    return -1;
+#endif
+}
+
+static void
+set_child_interest(size_t i, short events) {
+    Child *child = children + i;
+    if (child->io_events == events) return;
+    child->io_events = events;
+#ifdef USE_EPOLL
+    struct epoll_event ev = {.events = as_epoll_events(events), .data.fd = child->fd};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, child->fd, &ev) != 0) perror("Call to epoll_ctl() for child fd failed");
+#else
+    children_fds[EXTRA_FDS + i].events = events;
+#endif
+}
+
+static bool
+read_buf_is_starved(Screen *screen) {
+    // Returns true if read_buf is full, in which case the main thread is
+    // guaranteed to wake up the I/O thread once it has parsed some of it. The
+    // flag is set, only when the buffer is full, before checking the tail
+    // again and the main thread clears it after storing the tail, so at least
+    // one side sees the other's write.
+    if (!screen->read_buf_sz) return false;
+    const size_t head = atomic_load_explicit(&screen->read_buf_head, memory_order_relaxed);
+    if (head - atomic_load(&screen->read_buf_tail) < screen->read_buf_sz) return false;
+    atomic_store(&screen->read_buf_starved, true);
+    if (head - atomic_load(&screen->read_buf_tail) >= screen->read_buf_sz) return true;
+    // some of it was parsed in the meantime, no need to be woken up
+    atomic_store(&screen->read_buf_starved, false);
+    return false;
+}
+
+static void
+rearm_read_starved_children(ChildMonitor *self) {
+    // Resume reading from children whose read buffer has been drained by the main thread
+    size_t still_starved = 0;
+    for (size_t k = 0; k < read_starved_count; k++) {
+        ssize_t i = child_index_for_fd(self, read_starved_fds[k]);
+        if (i < 0 || children[i].io_events & POLLIN) continue;
+        if (read_buf_is_starved(children[i].screen)) read_starved_fds[still_starved++] = read_starved_fds[k];
+        else set_child_interest(i, children[i].io_events | POLLIN);
+    }
+    read_starved_count = still_starved;
+}
+
+static void
+arm_pending_writes(ChildMonitor *self) {
+    // Must be called with children_lock held
+    if (UNLIKELY(write_pending_overflow)) {
+        for (size_t i = 0; i < self->count; i++) set_child_interest(i, children[i].io_events | POLLOUT);
+        write_pending_overflow = false;
+    } else {
+        for (size_t k = 0; k < write_pending_count; k++) {
+            ssize_t i = child_index_for_fd(self, write_pending_fds[k]);
+            if (i > -1) set_child_interest(i, children[i].io_events | POLLOUT);
+        }
+    }
+    write_pending_count = 0;
+}
+
 static void
 add_children(ChildMonitor *self) {
     for (; add_queue_count > 0 && self->count < MAX_CHILDREN;) {
         add_queue_count--;
-        children[self->count] = add_queue[add_queue_count];
+        Child *child = children + self->count;
+        *child = add_queue[add_queue_count];
         add_queue[add_queue_count] = EMPTY_CHILD;
-        children_fds[EXTRA_FDS + self->count].fd = children[self->count].fd;
+        child->io_events = POLLIN;
+#ifdef USE_EPOLL
+        struct epoll_event ev = {.events = EPOLLIN, .data.fd = child->fd};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, child->fd, &ev) != 0) perror("Call to epoll_ctl() to add child fd failed");
+        map_fd_to_child(child->fd, self->count);
+#else
+        children_fds[EXTRA_FDS + self->count].fd = child->fd;
         children_fds[EXTRA_FDS + self->count].events = POLLIN;
+#endif
         self->count++;
     }
 }
@@ -1320,53 +1631,182 @@ remove_children(ChildMonitor *self) {
         for (ssize_t i = self->count - 1; i >= 0; i--) {
             if (children[i].needs_removal) {
                 count++;
+#ifdef USE_EPOLL
+                if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, children[i].fd, NULL) != 0) perror("Call to epoll_ctl() to remove child fd failed");
+                fd_to_child[children[i].fd] = -1;
+#endif
                 cleanup_child(i);
                 remove_queue[remove_queue_count] = children[i];
                 remove_queue_count++;
                 children[i] = EMPTY_CHILD;
-                children_fds[EXTRA_FDS + i].fd = -1;
                 size_t num_to_right = self->count - 1 - i;
-                if (num_to_right > 0) {
-                    memmove(children + i, children + i + 1, num_to_right * sizeof(Child));
-                    memmove(children_fds + EXTRA_FDS + i, children_fds + EXTRA_FDS + i + 1, num_to_right * sizeof(struct pollfd));
-                }
+#ifndef USE_EPOLL
+                children_fds[EXTRA_FDS + i].fd = -1;
+                if (num_to_right > 0) memmove(children_fds + EXTRA_FDS + i, children_fds + EXTRA_FDS + i + 1, num_to_right * sizeof(struct pollfd));
+#endif
+                if (num_to_right > 0) memmove(children + i, children + i + 1, num_to_right * sizeof(Child));
             }
         }
         self->count -= count;
+#ifdef USE_EPOLL
+        if (count) { for (size_t i = 0; i < self->count; i++) fd_to_child[children[i].fd] = i; }
+#endif
     }
 }
 
 
-static bool
-read_bytes(int fd, Screen *screen) {
-    ssize_t len;
-    size_t available_buffer_space, orig_sz;
+static size_t
+encode_varint(uint8_t *dest, uint64_t val) {
+    size_t n = 0;
+    do {
+        const uint8_t b = val & 0x7f;
+        val >>= 7;
+        dest[n++] = b | (val ? 0x80 : 0);
+    } while (val);
+    return n;
+}
 
-    screen_mutex(lock, read);
-    orig_sz = screen->read_buf_sz;
-    if (orig_sz >= READ_BUF_SZ) { screen_mutex(unlock, read); return true; }  // screen read buffer is full
-    available_buffer_space = READ_BUF_SZ - orig_sz;
-    screen_mutex(unlock, read);
+static void
+record_pty_chunk(id_type window_id, const uint8_t *data, size_t sz) {
+    // Each chunk is: varint(ns since previous chunk) varint(window id) varint(size) bytes
+    uint8_t header[3 * 10];
+    const monotonic_t now = monotonic();
+    size_t hsz = encode_varint(header, MAX(0, now - pty_record_last_at));
+    hsz += encode_varint(header + hsz, window_id);
+    hsz += encode_varint(header + hsz, sz);
+    pty_record_last_at = now;
+    if (!write_all(pty_record_fd, header, hsz) || !write_all(pty_record_fd, data, sz)) {
+        log_error("Failed to write to PTY recording file, recording stopped with error: %s", strerror(errno));
+        pty_record_fd = -1;
+    }
+}
+
+static_assert((READ_BUF_SZ & (READ_BUF_SZ - 1)) == 0, "READ_BUF_SZ must be a power of two");
+static_assert((MIN_READ_BUF_SZ & (MIN_READ_BUF_SZ - 1)) == 0 && MIN_READ_BUF_SZ <= READ_BUF_SZ, "MIN_READ_BUF_SZ must be a power of two no larger than READ_BUF_SZ");
+// Read buffers of windows that have received no data for this long are freed
+#define READ_BUF_IDLE_TIMEOUT s_to_monotonic_t(30ll)
+static monotonic_t next_read_buf_release_at = 0;
 
-    while(true) {
-        len = read(fd, screen->read_buf + orig_sz, available_buffer_space);
+static void
+resize_read_buf(Screen *screen, size_t sz) {
+    // Must only be called when read_buf is empty, the new size is published
+    // to the main thread by the release store of read_buf_head in read_bytes()
+    free(screen->read_buf);
+    screen->read_buf = NULL; screen->read_buf_sz = 0;
+    if (sz) {
+        screen->read_buf = malloc(sz);
+        if (!screen->read_buf) fatal("Out of memory allocating read buffer");
+        screen->read_buf_sz = sz;
+    }
+}
+
+static void
+release_idle_read_bufs(ChildMonitor *self, monotonic_t now) {
+    if (!next_read_buf_release_at || now < next_read_buf_release_at) return;
+    next_read_buf_release_at = 0;
+    for (size_t i = 0; i < self->count; i++) {
+        Screen *screen = children[i].screen;
+        if (!screen->read_buf) continue;
+        monotonic_t release_at = screen->read_buf_used_at + READ_BUF_IDLE_TIMEOUT;
+        if (release_at <= now) {
+            if (atomic_load_explicit(&screen->read_buf_tail, memory_order_acquire) == atomic_load_explicit(&screen->read_buf_head, memory_order_relaxed)) {
+                resize_read_buf(screen, 0);
+                continue;
+            }
+            release_at = now + READ_BUF_IDLE_TIMEOUT;  // not yet parsed by the main thread
+        }
+        if (!next_read_buf_release_at || release_at < next_read_buf_release_at) next_read_buf_release_at = release_at;
+    }
+}
+
+// Adaptive input coalescing {{{
+// The I/O thread measures the rate at which each window receives data and
+// from it picks how long to wait for more data before parsing, so that
+// interactive output such as the echo of typed characters is parsed at once
+// while floods of output are parsed in large batches. The delay grows from
+// zero at INTERACTIVE_INPUT_RATE to twice input_delay at BULK_INPUT_RATE,
+// but never exceeds repaint_delay as parsing in batches larger than a frame
+// gains nothing.
+#define INTERACTIVE_INPUT_RATE (32. * 1024.)  // bytes per second
+#define BULK_INPUT_RATE (32. * 1024. * 1024.)
+#define INPUT_RATE_TIME_CONSTANT ms_to_monotonic_t(100ll)
+#define INPUT_DELAY_STEP (MONOTONIC_T_1e6 / 4)
+
+static monotonic_t
+input_delay_for_rate(double bytes_per_sec) {
+    if (bytes_per_sec <= INTERACTIVE_INPUT_RATE) return 0;
+    const double frac = MIN(1., log2(bytes_per_sec / INTERACTIVE_INPUT_RATE) / log2(BULK_INPUT_RATE / INTERACTIVE_INPUT_RATE));
+    monotonic_t ans = MIN((monotonic_t)(2 * frac * OPT(input_delay)), OPT(repaint_delay));
+    return ans - ans % INPUT_DELAY_STEP;
+}
+
+static void
+update_input_delay(Screen *screen, size_t num_bytes, monotonic_t now) {
+    // Exponentially weighted moving average of the input rate, weighted by
+    // time so that it does not depend on how the data is split into reads
+    const monotonic_t elapsed = MAX(now - screen->input_rate.measured_at, (monotonic_t)1);
+    const double alpha = elapsed >= INPUT_RATE_TIME_CONSTANT ? 1. : (double)elapsed / (double)INPUT_RATE_TIME_CONSTANT;
+    // alpha times the instantaneous rate, num_bytes / elapsed, without the division blowing up for tiny intervals
+    const double weighted_rate = num_bytes / monotonic_t_to_s_double(MAX(elapsed, INPUT_RATE_TIME_CONSTANT));
+    screen->input_rate.bytes_per_sec = (1. - alpha) * screen->input_rate.bytes_per_sec + weighted_rate;
+    screen->input_rate.measured_at = now;
+    const monotonic_t delay = input_delay_for_rate(screen->input_rate.bytes_per_sec);
+    if (delay != atomic_load_explicit(&screen->input_delay, memory_order_relaxed)) {
+        atomic_store_explicit(&screen->input_delay, delay, memory_order_relaxed);
+        if (global_state.debug_rendering) log_error(
+            "Input delay for window %llu changed to %.2f ms at %.1f KiB/s", screen->window_id,
+            monotonic_t_to_s_double(delay) * 1000., screen->input_rate.bytes_per_sec / 1024.);
+    }
+}
+// }}}
+
+static bool
+read_bytes(int fd, Screen *screen) {
+    // Producer side of the read_buf ring buffer, see parse_worker() for the
+    // consumer. Reads go straight into the free space, which may wrap around
+    // the end of the buffer, so the data is never copied and never waits on
+    // a parse in progress.
+    const size_t head = atomic_load_explicit(&screen->read_buf_head, memory_order_relaxed);
+    const size_t used = head - atomic_load_explicit(&screen->read_buf_tail, memory_order_acquire);
+    if (!used) {
+        // The buffer is allocated on first use and doubled in size whenever it
+        // was filled up completely, so windows producing little output use
+        // little memory. It can only be replaced while the main thread is not using it.
+        if (!screen->read_buf) resize_read_buf(screen, MIN_READ_BUF_SZ);
+        else if (screen->read_buf_filled && screen->read_buf_sz < READ_BUF_SZ) resize_read_buf(screen, screen->read_buf_sz * 2);
+        screen->read_buf_filled = false;
+    }
+    const size_t free_space = screen->read_buf_sz - used;
+    size_t total = 0;
+    if (!free_space) { screen->read_buf_filled = true; return true; }  // screen read buffer is full
+
+    while (total < free_space) {
+        const size_t pos = (head + total) & (screen->read_buf_sz - 1), sz = MIN(free_space - total, screen->read_buf_sz - pos);
+        ssize_t len = read(fd, screen->read_buf + pos, sz);
         if (len < 0) {
-            if (errno == EINTR || errno == EAGAIN) continue;
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || total) break;
             if (errno != EIO) perror("Call to read() from child fd failed");
             return false;
         }
-        break;
+        if (UNLIKELY(len == 0)) {
+            if (total) break;
+            return false;
+        }
+        if (UNLIKELY(pty_record_fd > -1)) record_pty_chunk(screen->window_id, screen->read_buf + pos, len);
+        total += len;
+        if ((size_t)len < sz) break;  // the kernel buffer has been drained
     }
-    if (UNLIKELY(len == 0)) return false;
 
-    screen_mutex(lock, read);
-    if (screen->new_input_at == 0) screen->new_input_at = monotonic();
-    if (orig_sz != screen->read_buf_sz) {
-        // The other thread consumed some of the screen read buffer
-        memmove(screen->read_buf + screen->read_buf_sz, screen->read_buf + orig_sz, len);
+    if (total) {
+        monotonic_t expected = 0;
+        screen->read_buf_used_at = monotonic();
+        if (total == free_space) screen->read_buf_filled = true;
+        update_input_delay(screen, total, screen->read_buf_used_at);
+        if (!next_read_buf_release_at) next_read_buf_release_at = screen->read_buf_used_at + READ_BUF_IDLE_TIMEOUT;
+        atomic_compare_exchange_strong_explicit(&screen->new_input_at, &expected, screen->read_buf_used_at, memory_order_relaxed, memory_order_relaxed);
+        atomic_store_explicit(&screen->read_buf_head, head + total, memory_order_release);
     }
-    screen->read_buf_sz += len;
-    screen_mutex(unlock, read);
     return true;
 }
 
@@ -1454,7 +1894,7 @@ print_text(const unsigned char *text, ssize_t sz) {
 #endif
 
 
-static void
+static bool
 write_to_child(int fd, Screen *screen) {
     size_t written = 0;
     ssize_t ret = 0;
@@ -1489,77 +1929,117 @@ write_to_child(int fd, Screen *screen) {
             memmove(screen->write_buf, screen->write_buf + written, screen->write_buf_used);
         }
     }
+    const bool has_more = screen->write_buf_used > 0;
     screen_mutex(unlock, write);
+    return has_more;
+}
+
+static void
+handle_signals(ChildMonitor *self, int fd) {
+    SignalSet ss = {0};
+    read_signals(fd, handle_signal, &ss);
+    if (ss.kill_signal || ss.reload_config) {
+        children_mutex(lock);
+        if (ss.kill_signal) kill_signal_received = true;
+        if (ss.reload_config) reload_config_signal_received = true;
+        children_mutex(unlock);
+    }
+    if (ss.child_died) reap_children(self, OPT(close_on_child_death));
+}
+
+static bool
+handle_child_events(size_t i, short revents) {
+    Child *child = children + i;
+    bool data_received = false;
+    if (revents & (POLLIN | POLLHUP | POLLERR)) {
+        data_received = true;
+        if (!read_bytes(child->fd, child->screen)) {
+            // child is dead
+            children_mutex(lock);
+            child->needs_removal = true;
+            children_mutex(unlock);
+        } else if (child->io_events & POLLIN && read_buf_is_starved(child->screen)) {
+            // Stop waiting for input until the main thread has parsed some of the read buffer
+            set_child_interest(i, child->io_events & ~POLLIN);
+            read_starved_fds[read_starved_count++] = child->fd;
+        }
+    }
+    if (revents & POLLOUT) {
+        if (!write_to_child(child->fd, child->screen)) set_child_interest(i, child->io_events & ~POLLOUT);
+    }
+    if (revents & POLLNVAL) {
+        // fd was closed
+        children_mutex(lock);
+        child->needs_removal = true;
+        children_mutex(unlock);
+        log_error("The child %lu had its fd unexpectedly closed", child->id);
+    }
+    return data_received;
 }
 
 static void*
 io_loop(void *data) {
     // The I/O thread loop
     size_t i;
-    int ret;
-    bool has_more, data_received, has_pending_wakeups = false;
-    monotonic_t last_main_loop_wakeup_at = -1, now = -1;
-    Screen *screen;
+    int ret, timeout;
+    bool data_received, has_pending_wakeups = false;
+    monotonic_t last_main_loop_wakeup_at = -1, now = -1, wakeup_delay = 0, delay = 0;
     ChildMonitor *self = (ChildMonitor*)data;
     set_thread_name("KittyChildMon");
+// the main loop is woken up after the smallest input delay of the windows that received data
+#define DATA_RECEIVED(input_delay) { \
+    monotonic_t d = input_delay; \
+    delay = data_received ? MIN(delay, d) : d; data_received = true; \
+}
+#define CHILD_DATA_RECEIVED(i) DATA_RECEIVED(atomic_load_explicit(&children[i].screen->input_delay, memory_order_relaxed))
 
     while (LIKELY(!self->shutting_down)) {
         children_mutex(lock);
         remove_children(self);
         add_children(self);
+        arm_pending_writes(self);
         children_mutex(unlock);
+        if (read_starved_count) rearm_read_starved_children(self);
         data_received = false;
-        for (i = 0; i < self->count + EXTRA_FDS; i++) children_fds[i].revents = 0;
-        for (i = 0; i < self->count; i++) {
-            screen = children[i].screen;
-            /* printf("i:%lu id:%lu fd: %d read_buf_sz: %lu write_buf_used: %lu\n", i, children[i].id, children[i].fd, screen->read_buf_sz, screen->write_buf_used); */
-            screen_mutex(lock, read); screen_mutex(lock, write);
-            children_fds[EXTRA_FDS + i].events = (screen->read_buf_sz < READ_BUF_SZ ? POLLIN : 0) | (screen->write_buf_used ? POLLOUT  : 0);
-            screen_mutex(unlock, read); screen_mutex(unlock, write);
-        }
+        timeout = -1;
+        now = monotonic();
+        release_idle_read_bufs(self, now);
         if (has_pending_wakeups) {
-            now = monotonic();
-            monotonic_t time_delta = OPT(input_delay) - (now - last_main_loop_wakeup_at);
-            if (time_delta >= 0) ret = poll(children_fds, self->count + EXTRA_FDS, monotonic_t_to_ms(time_delta));
-            else ret = 0;
-        } else {
-            ret = poll(children_fds, self->count + EXTRA_FDS, -1);
+            monotonic_t time_delta = wakeup_delay - (now - last_main_loop_wakeup_at);
+            timeout = time_delta >= 0 ? monotonic_t_to_ms(time_delta) : 0;
         }
-        if (ret > 0) {
-            if (children_fds[0].revents && POLLIN) drain_fd(children_fds[0].fd); // wakeup
-            if (children_fds[1].revents && POLLIN) {
-                SignalSet ss = {0};
-                data_received = true;
-                read_signals(children_fds[1].fd, handle_signal, &ss);
-                if (ss.kill_signal || ss.reload_config) {
-                    children_mutex(lock);
-                    if (ss.kill_signal) kill_signal_received = true;
-                    if (ss.reload_config) reload_config_signal_received = true;
-                    children_mutex(unlock);
-                }
-                if (ss.child_died) reap_children(self, OPT(close_on_child_death));
+        if (next_read_buf_release_at && timeout != 0) {
+            int release_timeout = monotonic_t_to_ms(next_read_buf_release_at - now) + 1;
+            timeout = timeout < 0 ? release_timeout : MIN(timeout, release_timeout);
+        }
+#ifdef USE_EPOLL
+        ret = epoll_wait(epoll_fd, ready_events, arraysz(ready_events), timeout);
+        for (int r = 0; r < ret; r++) {
+            const int fd = ready_events[r].data.fd;
+            const uint32_t ev = ready_events[r].events;
+            if (fd == self->io_loop_data.wakeup_read_fd) drain_fd(fd);
+            else if (fd == self->io_loop_data.signal_read_fd) { handle_signals(self, fd); DATA_RECEIVED(OPT(input_delay)); }
+            else {
+                ssize_t idx = child_index_for_fd(self, fd);
+                const short revents = (ev & EPOLLIN ? POLLIN : 0) | (ev & EPOLLOUT ? POLLOUT : 0) | (ev & EPOLLHUP ? POLLHUP : 0) | (ev & EPOLLERR ? POLLERR : 0);
+                if (idx > -1 && handle_child_events(idx, revents)) CHILD_DATA_RECEIVED(idx);
             }
+        }
+#ifdef DEBUG_POLL_EVENTS
+        for (int r = 0; r < ret; r++) {
+#define P(w) if (ready_events[r].events & w) printf("fd:%d %s\n", ready_events[r].data.fd, #w);
+            P(EPOLLIN); P(EPOLLPRI); P(EPOLLOUT); P(EPOLLERR); P(EPOLLHUP);
+#undef P
+        }
+#endif
+#else
+        for (i = 0; i < self->count + EXTRA_FDS; i++) children_fds[i].revents = 0;
+        ret = poll(children_fds, self->count + EXTRA_FDS, timeout);
+        if (ret > 0) {
+            if (children_fds[0].revents & POLLIN) drain_fd(children_fds[0].fd); // wakeup
+            if (children_fds[1].revents & POLLIN) { handle_signals(self, children_fds[1].fd); DATA_RECEIVED(OPT(input_delay)); }
             for (i = 0; i < self->count; i++) {
-                if (children_fds[EXTRA_FDS + i].revents & (POLLIN | POLLHUP)) {
-                    data_received = true;
-                    has_more = read_bytes(children_fds[EXTRA_FDS + i].fd, children[i].screen);
-                    if (!has_more) {
-                        // child is dead
-                        children_mutex(lock);
-                        children[i].needs_removal = true;
-                        children_mutex(unlock);
-                    }
-                }
-                if (children_fds[EXTRA_FDS + i].revents & POLLOUT) {
-                    write_to_child(children[i].fd, children[i].screen);
-                }
-                if (children_fds[EXTRA_FDS + i].revents & POLLNVAL) {
-                    // fd was closed
-                    children_mutex(lock);
-                    children[i].needs_removal = true;
-                    children_mutex(unlock);
-                    log_error("The child %lu had its fd unexpectedly closed", children[i].id);
-                }
+                if (children_fds[EXTRA_FDS + i].revents && handle_child_events(i, children_fds[EXTRA_FDS + i].revents)) CHILD_DATA_RECEIVED(i);
             }
 #ifdef DEBUG_POLL_EVENTS
             for (i = 0; i < self->count + EXTRA_FDS; i++) {
@@ -1568,22 +2048,27 @@ io_loop(void *data) {
 #undef P
             }
 #endif
-        } else if (ret < 0) {
+        }
+#endif
+        if (ret < 0) {
             if (errno != EAGAIN && errno != EINTR) {
                 perror("Call to poll() failed");
             }
         }
 #define WAKEUP { wakeup_main_loop(); last_main_loop_wakeup_at = now; has_pending_wakeups = false; }
-        // we only wakeup the main loop after input_delay as wakeup is an expensive operation
+        // we only wakeup the main loop after the input delay as wakeup is an expensive operation
         // on some platforms, such as cocoa
         if (data_received) {
-            if ((now = monotonic()) - last_main_loop_wakeup_at > OPT(input_delay)) WAKEUP
+            wakeup_delay = has_pending_wakeups ? MIN(wakeup_delay, delay) : delay;
+            if ((now = monotonic()) - last_main_loop_wakeup_at > wakeup_delay) WAKEUP
             else has_pending_wakeups = true;
         } else {
-            if (has_pending_wakeups && (now = monotonic()) - last_main_loop_wakeup_at > OPT(input_delay)) WAKEUP
+            if (has_pending_wakeups && (now = monotonic()) - last_main_loop_wakeup_at > wakeup_delay) WAKEUP
         }
     }
 #undef WAKEUP
+#undef CHILD_DATA_RECEIVED
+#undef DATA_RECEIVED
     children_mutex(lock);
     for (i = 0; i < self->count; i++) children[i].needs_removal = true;
     remove_children(self);
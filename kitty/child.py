@@ -5,7 +5,7 @@
 import sys
 from collections import defaultdict
 from contextlib import contextmanager, suppress
-from typing import TYPE_CHECKING, DefaultDict, Dict, Generator, List, Optional, Sequence, Tuple
+from typing import TYPE_CHECKING, DefaultDict, Dict, Generator, List, Optional, Sequence, Tuple, Union
 
 import kitty.fast_data_types as fast_data_types
 
@@ -195,7 +195,7 @@ def __init__(
         self,
         argv: Sequence[str],
         cwd: str,
-        stdin: Optional[bytes] = None,
+        stdin: Optional[Union[bytes, int]] = None,  # an int is a file descriptor that is closed after use
         env: Optional[Dict[str, str]] = None,
         cwd_from: Optional['CwdRequest'] = None,
         is_clone_launch: str = '',
@@ -268,7 +268,10 @@ def fork(self) -> Optional[int]:
         ready_read_fd, ready_write_fd = os.pipe()
         os.set_inheritable(ready_write_fd, False)
         os.set_inheritable(ready_read_fd, True)
-        if stdin is not None:
+        if isinstance(stdin, int):
+            stdin_read_fd, stdin_write_fd = stdin, -1
+            os.set_inheritable(stdin_read_fd, True)
+        elif stdin is not None:
             stdin_read_fd, stdin_write_fd = os.pipe()
             os.set_inheritable(stdin_write_fd, False)
             os.set_inheritable(stdin_read_fd, True)
@@ -320,7 +323,8 @@ def fork(self) -> Optional[int]:
         self.child_fd = master
         if stdin is not None:
             os.close(stdin_read_fd)
-            fast_data_types.thread_write(stdin_write_fd, stdin)
+            if not isinstance(stdin, int):
+                fast_data_types.thread_write(stdin_write_fd, stdin)
         os.close(ready_read_fd)
         self.terminal_ready_fd = ready_write_fd
         if self.child_fd is not None:
@@ -17,6 +17,7 @@ typedef enum {
     COCOA_CLEANUP_FUNC,
     PNG_READER_CLEANUP_FUNC,
     FONTCONFIG_CLEANUP_FUNC,
+    HISTORY_CLEANUP_FUNC,
 
     NUM_CLEANUP_FUNCS
 } AtExitCleanupFunc;
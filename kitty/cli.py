@@ -984,6 +984,28 @@ def options_spec() -> str:
 Path to file in which to store the raw bytes received from the child process.
 
 
+--record-pty
+Path to file in which to record the bytes received from all child processes,
+along with the time at which they were received. The recording can be played
+back with :option:`{appname} --replay-pty` or fed to the parser with no GUI by
+:file:`kitty_tests/bench_parse.py`, to reproduce performance problems.
+
+
+--replay-pty
+Replay the output of the first window in a recording previously created by
+:option:`{appname} --record-pty`, with its original timing. You can open a new
+kitty window to replay the recording with::
+
+    {appname} sh -c "{appname} --replay-pty /path/to/recording; read"
+
+
+--replay-pty-speed
+type=float
+default=1
+The speed at which to replay with :option:`{appname} --replay-pty`, as a
+multiple of the original speed. Zero means replay as fast as possible.
+
+
 --debug-rendering --debug-gl
 type=bool-set
 Debug rendering commands. This will cause all OpenGL calls to check for errors
@@ -706,6 +706,15 @@
     return "";
 }
 
+void*
+clone_face_for_thread(PyObject *face UNUSED) {
+    // CoreText rendering uses shared buffers, glyphs are rendered on the main thread
+    return NULL;
+}
+
+void
+free_face_clone(void *clone UNUSED) {}
+
 
 static PyObject *
 repr(CTFace *self) {
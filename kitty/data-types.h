@@ -260,12 +260,44 @@ typedef struct {
     GPUCell *gpu_cells;
     CPUCell *cpu_cells;
     LineAttrs *line_attrs;
+    // When not NULL the cells are compressed and cpu_cells and gpu_cells are
+    // NULL, except while the segment is being overwritten, see below
+    uint8_t *compressed_cells;
+    size_t compressed_cells_sz;
+    // While the oldest lines of the buffer, in a compressed segment, are
+    // overwritten both the cells and compressed_cells are set. The cells hold
+    // the lines before overwritten, the others are still compressed, the
+    // line overwritten starting at compressed_pos.
+    index_type overwritten;
+    size_t compressed_pos;
+    // Set while the cells are being compressed in the background
+    struct CompressionJob *compression;
+    // When true the compressed cells are in the spill file at spill_offset instead
+    bool spilled;
+    size_t spill_offset, spill_capacity;
+    // Trigram index of the text of the lines. The lines from indexed_lines on
+    // are added to it lazily, as are the lines from old_indexed_lines on that
+    // were in the segment before its first line was last overwritten.
+    uint32_t *search_index;
+    index_type indexed_lines, old_indexed_lines;
+    // The number of cells up to the last non-blank cell of each line, with
+    // the high bit set for lines that continue on the next line
+    index_type *line_lengths;
 } HistoryBufSegment;
+#define NUM_HOT_HISTORY_SEGMENTS 4
+#define MAX_PAGERHIST_CONVERSIONS 2
 
 typedef struct {
-    void *ringbuf;
+    // The text is in num_chunks chunks of chunk_size bytes, starting at start in the first chunk and ending at end in the last
+    uint8_t **chunks, *spare_chunk;
+    size_t num_chunks, chunks_capacity, chunk_size, start, end, bytes_used;
     size_t maximum_size;
     bool rewrap_needed;
+    // Lines evicted from the history buffer that are yet to be converted to ANSI text
+    struct { uint8_t *buf; size_t start, end, capacity, num_lines, min_text_sz; bool last_line_wrapped; } pending;
+    // Batches of pending lines being converted in the background, oldest first
+    struct ConversionJob *converting[MAX_PAGERHIST_CONVERSIONS];
+    size_t num_converting;
 } PagerHistoryBuf;
 
 typedef struct {int x;} *HYPERLINK_POOL_HANDLE;
@@ -276,14 +308,24 @@ typedef struct {
     hyperlink_id_type active_hyperlink_id;
 } ANSIBuf;
 
-typedef struct {
+typedef struct HistoryBuf {
     PyObject_HEAD
 
     index_type xnum, ynum, num_segments;
     HistoryBufSegment *segments;
+    // The most recently used segments, most recent first, these are never compressed
+    index_type hot_segments[NUM_HOT_HISTORY_SEGMENTS], num_hot_segments;
+    // in_progress is the number of segments being compressed in the
+    // background, has_cold is set when segments that are not hot may be uncompressed
+    struct { size_t segments, bytes; index_type in_progress; bool has_cold; } compressed;
+    struct { size_t memory_limit, segments, bytes, file_size; int fd; bool failed; } spill;
     PagerHistoryBuf *pagerhist;
     Line *line;
     index_type start_of_data, count;
+    char_type *search_text;
+    // The oldest num_lines lines are the lines of src that have not yet been
+    // rewrapped to xnum, less the first skip cells of its text
+    struct { struct HistoryBuf *src; index_type num_lines, group_lines; size_t skip, group_cells; } reflow;
 } HistoryBuf;
 
 typedef struct {
@@ -346,6 +388,7 @@ typedef struct {FONTS_DATA_HEAD} *FONTS_DATA_HANDLE;
 
 #define PARSER_BUF_SZ (8 * 1024)
 #define READ_BUF_SZ (1024*1024)
+#define MIN_READ_BUF_SZ (64*1024)
 
 #define clear_sprite_position(cell) (cell).sprite_x = 0; (cell).sprite_y = 0; (cell).sprite_z = 0;
 
@@ -383,7 +426,7 @@ attrs_to_cursor(const CellAttrs attrs, Cursor *c) {
 Line* alloc_line(void);
 Cursor* alloc_cursor(void);
 LineBuf* alloc_linebuf(unsigned int, unsigned int);
-HistoryBuf* alloc_historybuf(unsigned int, unsigned int, unsigned int);
+HistoryBuf* alloc_historybuf(unsigned int, unsigned int, unsigned int, unsigned int);
 ColorProfile* alloc_color_profile(void);
 void copy_color_profile(ColorProfile*, ColorProfile*);
 PyObject* create_256_color_table(void);
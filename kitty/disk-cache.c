@@ -91,7 +91,7 @@ open_cache_file_without_tmpfile(const char *cache_path) {
     return fd;
 }
 
-static int
+int
 open_cache_file(const char *cache_path) {
     int fd = -1;
 #ifdef O_TMPFILE
@@ -986,6 +986,22 @@ def test_render_line(line: Line) -> None:
     pass
 
 
+def shaped_run_cache_info(reset: bool = False) -> Dict[str, int]:
+    pass
+
+
+def test_update_cell_data(screen: Screen, buf: bytearray, cursor_has_moved: bool = False) -> int:
+    pass
+
+
+def test_threaded_rasterization(enabled: bool) -> bool:
+    pass
+
+
+def test_send_rasterized_sprites() -> None:
+    pass
+
+
 def sprite_map_set_limits(w: int, h: int) -> None:
     pass
 
@@ -1020,6 +1036,10 @@ def create_test_font_group(sz: float, dpix: float,
     pass
 
 
+def test_rewrap_ranges(num: int) -> None:
+    pass
+
+
 class HistoryBuf:
 
     def pagerhist_as_text(self, upto_output_start: bool = False) -> str:
@@ -1028,6 +1048,15 @@ class HistoryBuf:
     def pagerhist_as_bytes(self) -> bytes:
         pass
 
+    def compression_stats(self) -> Dict[str, int]:
+        pass
+
+    def compress_cold_segments(self) -> None:
+        pass
+
+    def search(self, query: str, lnum: int = 0, backwards: bool = True) -> Optional[Tuple[int, int, int]]:
+        pass
+
 
 class LineBuf:
 
@@ -1146,6 +1175,9 @@ class Screen:
     def scroll_to_next_mark(self, mark: int = 0, backwards: bool = True) -> bool:
         pass
 
+    def search_scrollback(self, query: str, backwards: bool = True) -> bool:
+        pass
+
     def scroll_to_prompt(self, num_of_prompts: int = -1) -> bool:
         pass
 
@@ -1177,6 +1209,9 @@ class Screen:
     as_text_alternate = as_text
     as_text_for_history_buf = as_text
 
+    def write_scrollback_for_pager(self, fd: int) -> int:
+        pass
+
     def cmd_output(self, which: int, callback: Callable[[str], None], as_ansi: bool, insert_wrap_markers: bool) -> bool:
         pass
 
@@ -1239,6 +1274,7 @@ class ChildMonitor:
         dump_callback: Optional[Callable[[bytes], None]],
         talk_fd: int = -1,
         listen_fd: int = -1,
+        record_fd: int = -1,
     ):
         pass
 
@@ -13,9 +13,12 @@
 #include "charsets.h"
 #include "glyph-cache.h"
 #include "kitty-uthash.h"
+#include "threading.h"
+#include <unistd.h>
 
 #define MISSING_GLYPH (NUM_UNDERLINE_STYLES + 2)
 #define MAX_NUM_EXTRA_GLYPHS_PUA 4u
+#define MAX_RASTER_WORKERS 4
 
 typedef void (*send_sprite_to_gpu_func)(FONTS_DATA_HANDLE fg, unsigned int, unsigned int, unsigned int, pixel*);
 send_sprite_to_gpu_func current_send_sprite_to_gpu = NULL;
@@ -45,6 +48,9 @@ static char_type shape_buffer[4096] = {0};
 static size_t max_texture_size = 1024, max_array_len = 1024;
 typedef enum { LIGA_FEATURE, DLIG_FEATURE, CALT_FEATURE } HBFeature;
 static PyObject* font_feature_settings = NULL;
+static char_type *shaped_run_key = NULL;
+static size_t shaped_run_key_capacity = 0;
+static struct { unsigned long long hits, misses; } shaped_run_cache_stats = {0};
 
 typedef struct {
     char_type left, right;
@@ -65,6 +71,15 @@ typedef struct {
     GlyphProperties *glyph_properties_hash_table;
     bool bold, italic, emoji_presentation;
     SpacerStrategy spacer_strategy;
+    // true if printable ASCII text is always shaped one codepoint to one
+    // glyph, in which case ASCII runs are rendered using ascii_sprites
+    // without shaping them
+    bool ascii_fast_path;
+    SpritePosition *ascii_sprites[128];
+    // copies of face for the rasterizer threads, one per thread, created on
+    // first use
+    void *thread_faces[MAX_RASTER_WORKERS];
+    bool thread_faces_created;
 } Font;
 
 typedef struct Canvas {
@@ -88,6 +103,7 @@ typedef struct {
     Canvas canvas;
     GPUSpriteTracker sprite_tracker;
     fallback_font_map_t *fallback_font_map;
+    ShapedRun *shaped_run_cache;
 } FontGroup;
 
 static FontGroup* font_groups = NULL;
@@ -95,6 +111,8 @@ static size_t font_groups_capacity = 0;
 static size_t num_font_groups = 0;
 static id_type font_group_id_counter = 0;
 static void initialize_font_group(FontGroup *fg);
+static bool has_ascii_fast_path(Font *font);
+static void cancel_raster_jobs(id_type font_group_id);
 
 static void
 ensure_canvas_can_fit(FontGroup *fg, unsigned cells) {
@@ -146,10 +164,18 @@ free_maps(Font *font) {
     font->sprite_position_hash_table = NULL;
     free_glyph_properties_hash_table(&font->glyph_properties_hash_table);
     font->glyph_properties_hash_table = NULL;
+    zero_at_ptr_count(font->ascii_sprites, arraysz(font->ascii_sprites));
+}
+
+static void
+free_thread_faces(Font *f) {
+    for (size_t i = 0; i < arraysz(f->thread_faces); i++) { free_face_clone(f->thread_faces[i]); f->thread_faces[i] = NULL; }
+    f->thread_faces_created = false;
 }
 
 static void
 del_font(Font *f) {
+    free_thread_faces(f);
     Py_CLEAR(f->face);
     free(f->ffs_hb_features); f->ffs_hb_features = NULL;
     free_maps(f);
@@ -158,6 +184,7 @@ del_font(Font *f) {
 
 static void
 del_font_group(FontGroup *fg) {
+    cancel_raster_jobs(fg->id);
     free(fg->canvas.buf); fg->canvas.buf = NULL; fg->canvas = (Canvas){0};
     fg->sprite_map = free_sprite_map(fg->sprite_map);
     if (fg->fallback_font_map) {
@@ -169,6 +196,7 @@ del_font_group(FontGroup *fg) {
         }
         fg->fallback_font_map = NULL;
     }
+    free_shaped_run_hash_table(&fg->shaped_run_cache);
     for (size_t i = 0; i < fg->fonts_count; i++) del_font(fg->fonts + i);
     free(fg->fonts); fg->fonts = NULL;
 }
@@ -325,6 +353,7 @@ init_font(Font *f, PyObject *face, bool bold, bool italic, bool emoji_presentati
         }
         memcpy(f->ffs_hb_features + f->num_ffs_hb_features++, &hb_features[CALT_FEATURE], sizeof(hb_feature_t));
     }
+    f->ascii_fast_path = has_ascii_fast_path(f);
     return true;
 }
 
@@ -336,6 +365,7 @@ free_font_groups(void) {
         font_groups_capacity = 0; num_font_groups = 0;
     }
     free_glyph_cache_global_resources();
+    free(shaped_run_key); shaped_run_key = NULL; shaped_run_key_capacity = 0;
 }
 
 static void
@@ -698,13 +728,19 @@ set_cell_sprite(GPUCell *cell, const SpritePosition *sp) {
 }
 
 static pixel*
-extract_cell_from_canvas(FontGroup *fg, unsigned int i, unsigned int num_cells) {
-    pixel *ans = fg->canvas.buf + (fg->cell_width * fg->cell_height * (fg->canvas.current_cells - 1)), *dest = ans, *src = fg->canvas.buf + (i * fg->cell_width);
-    unsigned int stride = fg->cell_width * num_cells;
-    for (unsigned int r = 0; r < fg->cell_height; r++, dest += fg->cell_width, src += stride) memcpy(dest, src, fg->cell_width * sizeof(fg->canvas.buf[0]));
+extract_cell(const pixel *canvas, pixel *ans, unsigned int i, unsigned int num_cells, unsigned int cell_width, unsigned int cell_height) {
+    pixel *dest = ans; const pixel *src = canvas + (i * cell_width);
+    unsigned int stride = cell_width * num_cells;
+    for (unsigned int r = 0; r < cell_height; r++, dest += cell_width, src += stride) memcpy(dest, src, cell_width * sizeof(canvas[0]));
     return ans;
 }
 
+static pixel*
+extract_cell_from_canvas(FontGroup *fg, unsigned int i, unsigned int num_cells) {
+    pixel *ans = fg->canvas.buf + (fg->cell_width * fg->cell_height * (fg->canvas.current_cells - 1));
+    return extract_cell(fg->canvas.buf, ans, i, num_cells, fg->cell_width, fg->cell_height);
+}
+
 typedef struct GlyphRenderScratch {
     SpritePosition* *sprite_positions;
     glyph_index *glyphs;
@@ -713,6 +749,235 @@ typedef struct GlyphRenderScratch {
 static GlyphRenderScratch global_glyph_render_scratch = {0};
 
 static void
+ensure_glyph_render_scratch(size_t sz) {
+    if (global_glyph_render_scratch.sz < sz) {
+#define a(what) free(global_glyph_render_scratch.what); global_glyph_render_scratch.what = malloc(sz * sizeof(global_glyph_render_scratch.what[0])); if (!global_glyph_render_scratch.what) fatal("Out of memory");
+        a(glyphs); a(sprite_positions);
+#undef a
+        global_glyph_render_scratch.sz = sz;
+    }
+}
+
+// Threaded rasterization {{{
+// Glyphs that are not yet in the sprite map are rasterized on a pool of
+// worker threads, so that a screen full of new text does not stall the main
+// thread. The sprite slots are reserved and assigned to the cells at once,
+// the cells are blank until the pixels are uploaded by the main thread, which
+// owns the GL context, in send_rasterized_sprites().
+
+typedef struct RasterSprite {
+    unsigned cell_idx;
+    sprite_index x, y, z;
+} RasterSprite;
+
+typedef struct RasterJob {
+    id_type font_group_id;
+    struct { FONTS_DATA_HEAD } fonts_data;
+    void *faces[MAX_RASTER_WORKERS];
+    unsigned baseline, num_glyphs, num_cells, num_sprites;
+    bool bold, italic, center_glyph, was_colored;
+    hb_glyph_info_t *info;
+    hb_glyph_position_t *positions;
+    RasterSprite *sprites;
+    pixel *canvas;
+    struct RasterJob *next;
+} RasterJob;
+
+static struct {
+    pthread_t threads[MAX_RASTER_WORKERS];
+    unsigned num_threads, num_in_flight;
+    bool initialized, shutting_down, enabled_for_tests;
+    pthread_mutex_t lock;
+    pthread_cond_t work_available, work_done;
+    RasterJob *pending, *pending_tail, *done;
+} rasterizer = {0};
+
+static void*
+raster_worker(void *data) {
+    const uintptr_t worker_idx = (uintptr_t)data;
+    set_thread_name("KittyRaster");
+    pthread_mutex_lock(&rasterizer.lock);
+    while (!rasterizer.shutting_down) {
+        RasterJob *job = rasterizer.pending;
+        if (!job) { pthread_cond_wait(&rasterizer.work_available, &rasterizer.lock); continue; }
+        if (!(rasterizer.pending = job->next)) rasterizer.pending_tail = NULL;
+        rasterizer.num_in_flight++;
+        pthread_mutex_unlock(&rasterizer.lock);
+        // a failure leaves the cells blank, same as on the main thread
+        render_glyphs_in_cells(
+            job->faces[worker_idx], job->bold, job->italic, job->info, job->positions, job->num_glyphs, job->canvas,
+            job->fonts_data.cell_width, job->fonts_data.cell_height, job->num_cells, job->baseline, &job->was_colored,
+            (FONTS_DATA_HANDLE)&job->fonts_data, job->center_glyph);
+        pthread_mutex_lock(&rasterizer.lock);
+        rasterizer.num_in_flight--;
+        job->next = rasterizer.done; rasterizer.done = job;
+        pthread_cond_broadcast(&rasterizer.work_done);
+    }
+    pthread_mutex_unlock(&rasterizer.lock);
+    return NULL;
+}
+
+static unsigned
+raster_pool_size(void) {
+    static long num_cpus = 0;
+    if (!num_cpus) num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned ans = num_cpus > 1 ? MIN((unsigned long)num_cpus - 1, (unsigned long)MAX_RASTER_WORKERS) : 0;
+    // the tests exercise the threaded code path even on a single CPU
+    if (!ans && rasterizer.enabled_for_tests) ans = 1;
+    return ans;
+}
+
+static bool
+start_rasterizer(void) {
+    if (rasterizer.initialized) return rasterizer.num_threads > 0;
+    rasterizer.initialized = true;
+    if (pthread_mutex_init(&rasterizer.lock, NULL) != 0 || pthread_cond_init(&rasterizer.work_available, NULL) != 0 || pthread_cond_init(&rasterizer.work_done, NULL) != 0) {
+        log_error("Failed to initialize the glyph rasterizer thread pool, rendering glyphs on the main thread only");
+        return false;
+    }
+    for (uintptr_t i = 0; i < raster_pool_size(); i++) {
+        int ret = pthread_create(rasterizer.threads + i, NULL, raster_worker, (void*)i);
+        if (ret != 0) { log_error("Failed to start glyph rasterizer thread with error: %s", strerror(ret)); break; }
+        rasterizer.num_threads++;
+    }
+    return rasterizer.num_threads > 0;
+}
+
+static RasterJob*
+drop_raster_jobs(RasterJob **head, id_type font_group_id) {
+    // Must be called with rasterizer.lock held, returns the new tail of the list
+    RasterJob *tail = NULL;
+    while (*head) {
+        RasterJob *job = *head;
+        if (!font_group_id || job->font_group_id == font_group_id) { *head = job->next; free(job); }
+        else { tail = job; head = &job->next; }
+    }
+    return tail;
+}
+
+static void
+cancel_raster_jobs(id_type font_group_id) {
+    if (!rasterizer.num_threads) return;
+    pthread_mutex_lock(&rasterizer.lock);
+    rasterizer.pending_tail = drop_raster_jobs(&rasterizer.pending, font_group_id);
+    // jobs being rendered cannot be interrupted, they use the faces of the font group
+    while (rasterizer.num_in_flight) pthread_cond_wait(&rasterizer.work_done, &rasterizer.lock);
+    drop_raster_jobs(&rasterizer.done, font_group_id);
+    pthread_mutex_unlock(&rasterizer.lock);
+}
+
+static void
+stop_rasterizer(void) {
+    if (!rasterizer.initialized) return;
+    if (rasterizer.num_threads) {
+        pthread_mutex_lock(&rasterizer.lock);
+        rasterizer.shutting_down = true;
+        pthread_cond_broadcast(&rasterizer.work_available);
+        pthread_mutex_unlock(&rasterizer.lock);
+        for (unsigned i = 0; i < rasterizer.num_threads; i++) pthread_join(rasterizer.threads[i], NULL);
+        drop_raster_jobs(&rasterizer.pending, 0); drop_raster_jobs(&rasterizer.done, 0);
+    }
+    pthread_mutex_destroy(&rasterizer.lock);
+    pthread_cond_destroy(&rasterizer.work_available); pthread_cond_destroy(&rasterizer.work_done);
+    const bool enabled_for_tests = rasterizer.enabled_for_tests;
+    zero_at_ptr(&rasterizer);
+    rasterizer.enabled_for_tests = enabled_for_tests;
+}
+
+static bool
+ensure_thread_faces(Font *font) {
+    if (!font->thread_faces_created) {
+        for (unsigned i = 0; i < raster_pool_size(); i++) {
+            if (!(font->thread_faces[i] = clone_face_for_thread(font->face))) { free_thread_faces(font); break; }
+        }
+        font->thread_faces_created = true;
+    }
+    return font->thread_faces[0] != NULL;
+}
+
+static bool
+rasterize_in_thread(FontGroup *fg, Font *font, SpritePosition **sp, unsigned num_cells, unsigned num_glyphs, hb_glyph_info_t *info, hb_glyph_position_t *positions, bool was_colored, bool center_glyph) {
+    // sprites sent to Python by the tests are expected synchronously
+    if (current_send_sprite_to_gpu != send_sprite_to_gpu && !rasterizer.enabled_for_tests) return false;
+    if (!raster_pool_size() || !ensure_thread_faces(font) || !start_rasterizer()) return false;
+    const size_t canvas_sz = sizeof(pixel) * fg->cell_width * fg->cell_height * (num_cells + 1);
+    RasterJob *job = calloc(1, sizeof(RasterJob) + num_glyphs * (sizeof(info[0]) + sizeof(positions[0])) + num_cells * sizeof(RasterSprite) + canvas_sz);
+    if (!job) return false;
+    job->info = (hb_glyph_info_t*)(job + 1);
+    job->positions = (hb_glyph_position_t*)(job->info + num_glyphs);
+    job->sprites = (RasterSprite*)(job->positions + num_glyphs);
+    job->canvas = (pixel*)(job->sprites + num_cells);
+    job->font_group_id = fg->id;
+    memcpy(&job->fonts_data, fg, sizeof(job->fonts_data));
+    memcpy(job->faces, font->thread_faces, sizeof(job->faces));
+    memcpy(job->info, info, num_glyphs * sizeof(info[0]));
+    memcpy(job->positions, positions, num_glyphs * sizeof(positions[0]));
+    job->baseline = fg->baseline; job->num_glyphs = num_glyphs; job->num_cells = num_cells;
+    job->bold = font->bold; job->italic = font->italic; job->center_glyph = center_glyph; job->was_colored = was_colored;
+    for (unsigned i = 0; i < num_cells; i++) {
+        if (sp[i]->rendered) continue;
+        // faces with colored glyphs are never rendered on the pool
+        sp[i]->rendered = true; sp[i]->colored = false;
+        job->sprites[job->num_sprites++] = (RasterSprite){.cell_idx=i, .x=sp[i]->x, .y=sp[i]->y, .z=sp[i]->z};
+    }
+    pthread_mutex_lock(&rasterizer.lock);
+    if (rasterizer.pending_tail) rasterizer.pending_tail->next = job;
+    else rasterizer.pending = job;
+    rasterizer.pending_tail = job;
+    pthread_cond_signal(&rasterizer.work_available);
+    pthread_mutex_unlock(&rasterizer.lock);
+    return true;
+}
+
+static bool
+font_group_has_os_window(id_type font_group_id) {
+    for (size_t o = 0; o < global_state.num_os_windows; o++) {
+        const OSWindow *w = global_state.os_windows + o;
+        if (w->fonts_data && ((FontGroup*)w->fonts_data)->id == font_group_id) return true;
+    }
+    return false;
+}
+
+static FontGroup*
+font_group_with_id(id_type font_group_id) {
+    for (size_t i = 0; i < num_font_groups; i++) if (font_groups[i].id == font_group_id) return font_groups + i;
+    return NULL;
+}
+
+bool
+send_rasterized_sprites(FONTS_DATA_HANDLE fgh, bool *has_pending) {
+    // Sends the sprites of the font group of the OS window being rendered, and
+    // those of font groups no OS window uses, which would otherwise never be sent
+    *has_pending = false;
+    if (!rasterizer.num_threads) return false;
+    const id_type font_group_id = ((FontGroup*)fgh)->id;
+    RasterJob *ready = NULL;
+    pthread_mutex_lock(&rasterizer.lock);
+    for (RasterJob **q = &rasterizer.done; *q; ) {
+        RasterJob *job = *q;
+        if (job->font_group_id == font_group_id || !font_group_has_os_window(job->font_group_id)) { *q = job->next; job->next = ready; ready = job; }
+        else q = &job->next;
+    }
+    *has_pending = rasterizer.pending || rasterizer.num_in_flight;
+    pthread_mutex_unlock(&rasterizer.lock);
+    const bool sent = ready != NULL;
+    while (ready) {
+        RasterJob *job = ready; ready = job->next;
+        const unsigned cw = job->fonts_data.cell_width, ch = job->fonts_data.cell_height;
+        // the jobs of deleted font groups have been cancelled
+        FONTS_DATA_HANDLE jfg = job->font_group_id == font_group_id ? fgh : (FONTS_DATA_HANDLE)font_group_with_id(job->font_group_id);
+        for (unsigned i = 0; jfg && i < job->num_sprites; i++) {
+            const RasterSprite *s = job->sprites + i;
+            pixel *buf = job->num_cells == 1 ? job->canvas : extract_cell(job->canvas, job->canvas + cw * ch * job->num_cells, s->cell_idx, job->num_cells, cw, ch);
+            current_send_sprite_to_gpu(jfg, s->x, s->y, s->z, buf);
+        }
+        free(job);
+    }
+    return sent;
+}
+// }}}
+
+static bool
 render_group(FontGroup *fg, unsigned int num_cells, unsigned int num_glyphs, CPUCell *cpu_cells, GPUCell *gpu_cells, hb_glyph_info_t *info, hb_glyph_position_t *positions, Font *font, glyph_index *glyphs, unsigned glyph_count, bool center_glyph) {
 #define sp global_glyph_render_scratch.sprite_positions
     int error = 0;
@@ -725,16 +990,20 @@ render_group(FontGroup *fg, unsigned int num_cells, unsigned int num_glyphs, CPU
         } else {
             sp[i] = sprite_position_for(fg, font, glyphs, glyph_count, ligature_index++, num_cells, &error);
         }
-        if (error != 0) { sprite_map_set_error(error); PyErr_Print(); return; }
+        if (error != 0) { sprite_map_set_error(error); PyErr_Print(); return false; }
         if (!sp[i]->rendered) all_rendered = false;
     }
     if (all_rendered) {
         for (unsigned i = 0; i < num_cells; i++) { set_cell_sprite(gpu_cells + i, sp[i]); }
-        return;
+        return true;
     }
 
-    ensure_canvas_can_fit(fg, num_cells + 1);
     bool was_colored = gpu_cells->attrs.width == 2 && is_emoji(cpu_cells->ch);
+    if (rasterize_in_thread(fg, font, sp, num_cells, num_glyphs, info, positions, was_colored, center_glyph)) {
+        for (unsigned i = 0; i < num_cells; i++) { set_cell_sprite(gpu_cells + i, sp[i]); }
+        return true;
+    }
+    ensure_canvas_can_fit(fg, num_cells + 1);
     render_glyphs_in_cells(font->face, font->bold, font->italic, info, positions, num_glyphs, fg->canvas.buf, fg->cell_width, fg->cell_height, num_cells, fg->baseline, &was_colored, (FONTS_DATA_HANDLE)fg, center_glyph);
     if (PyErr_Occurred()) PyErr_Print();
 
@@ -747,6 +1016,7 @@ render_group(FontGroup *fg, unsigned int num_cells, unsigned int num_glyphs, CPU
         }
         set_cell_sprite(gpu_cells + i, sp[i]);
     }
+    return true;
 #undef sp
 }
 
@@ -941,6 +1211,44 @@ detect_spacer_strategy(hb_font_t *hbf, Font *font) {
     }
 }
 
+static bool
+has_ascii_fast_path(Font *font) {
+    // Shape every pair of printable ASCII characters (as a de Bruijn
+    // sequence), every character repeated thrice and some well known longer
+    // ligatures. If all of them map one codepoint to one unpositioned glyph,
+    // the font has no ligatures or contextual alternates for ASCII text.
+    static const char *ligatures = " www <!-- --> <!--- /** **/ </> <=> <-> <~~ ~~> ..< ..= ::= =>> <<= >>= |||> <||| ||= ffi ffl 0xF ";
+    const char_type first = 0x20, last = 0x7e, k = last - first + 1;
+    const size_t num_cells = k * k + 1 + 3 * k + strlen(ligatures);
+    RAII_ALLOC(CPUCell, cpu_cells, calloc(num_cells, sizeof(CPUCell)));
+    RAII_ALLOC(GPUCell, gpu_cells, calloc(num_cells, sizeof(GPUCell)));
+    if (!cpu_cells || !gpu_cells) return false;
+    size_t n = 0;
+    // The concatenation of the Lyndon words of length one and two in lexical order
+    for (char_type i = 0; i < k; i++) {
+        cpu_cells[n++].ch = first + i;
+        for (char_type j = i + 1; j < k; j++) { cpu_cells[n++].ch = first + i; cpu_cells[n++].ch = first + j; }
+    }
+    cpu_cells[n++].ch = first;
+    for (char_type i = 0; i < k; i++) for (unsigned r = 0; r < 3; r++) cpu_cells[n++].ch = first + i;
+    for (const char *p = ligatures; *p; p++) cpu_cells[n++].ch = *p;
+    for (size_t i = 0; i < n; i++) gpu_cells[i].attrs.width = 1;
+
+    hb_font_t *hbf = harfbuzz_font_for_face(font->face);
+    // shape in overlapping chunks that fit in shape_buffer so that cluster numbers are cell indices
+    const size_t chunk_sz = 2048;
+    for (size_t start = 0; start + 1 < n; start += chunk_sz - 1) {
+        const size_t num = MIN(chunk_sz, n - start);
+        shape(cpu_cells + start, gpu_cells + start, num, hbf, font, false);
+        if (G(num_glyphs) != num) return false;
+        for (size_t i = 0; i < num; i++) {
+            if (G(info)[i].cluster != i || G(positions)[i].x_offset || G(positions)[i].y_offset) return false;
+            if (G(info)[i].codepoint != glyph_id_for_codepoint(font->face, cpu_cells[start + i].ch)) return false;
+        }
+    }
+    return true;
+}
+
 static LigatureType
 ligature_type_for_glyph(hb_font_t *hbf, glyph_index glyph_id, SpacerStrategy strategy) {
     static char glyph_name[128]; glyph_name[arraysz(glyph_name)-1] = 0;
@@ -1201,27 +1509,25 @@ split_run_at_offset(index_type cursor_offset, index_type *left, index_type *righ
 }
 
 
-static void
+static bool
 render_groups(FontGroup *fg, Font *font, bool center_glyph) {
-    unsigned idx = 0;
+    // Returns true if every cell in the run was given a sprite
+    unsigned idx = 0, num_cells = 0;
+    bool ok = true;
     while (idx <= G(group_idx)) {
         Group *group = G(groups) + idx;
         if (!group->num_cells) break;
+        num_cells += group->num_cells;
         /* printf("Group: idx: %u num_cells: %u num_glyphs: %u first_glyph_idx: %u first_cell_idx: %u total_num_glyphs: %zu\n", */
         /*         idx, group->num_cells, group->num_glyphs, group->first_glyph_idx, group->first_cell_idx, group_state.num_glyphs); */
         if (group->num_glyphs) {
-            size_t sz = MAX(group->num_glyphs, group->num_cells) + 16;
-            if (global_glyph_render_scratch.sz < sz) {
-#define a(what) free(global_glyph_render_scratch.what); global_glyph_render_scratch.what = malloc(sz * sizeof(global_glyph_render_scratch.what[0])); if (!global_glyph_render_scratch.what) fatal("Out of memory");
-                a(glyphs); a(sprite_positions);
-#undef a
-                global_glyph_render_scratch.sz = sz;
-            }
+            ensure_glyph_render_scratch(MAX(group->num_glyphs, group->num_cells) + 16);
             for (unsigned i = 0; i < group->num_glyphs; i++) global_glyph_render_scratch.glyphs[i] = G(info)[group->first_glyph_idx + i].codepoint;
-            render_group(fg, group->num_cells, group->num_glyphs, G(first_cpu_cell) + group->first_cell_idx, G(first_gpu_cell) + group->first_cell_idx, G(info) + group->first_glyph_idx, G(positions) + group->first_glyph_idx, font, global_glyph_render_scratch.glyphs, group->num_glyphs, center_glyph);
-        }
+            if (!render_group(fg, group->num_cells, group->num_glyphs, G(first_cpu_cell) + group->first_cell_idx, G(first_gpu_cell) + group->first_cell_idx, G(info) + group->first_glyph_idx, G(positions) + group->first_glyph_idx, font, global_glyph_render_scratch.glyphs, group->num_glyphs, center_glyph)) ok = false;
+        } else ok = false;
         idx++;
     }
+    return ok && num_cells == G(num_cells);
 }
 
 static PyObject*
@@ -1264,30 +1570,117 @@ test_shape(PyObject UNUSED *self, PyObject *args) {
 }
 #undef G
 
+static bool
+shape_and_render_run(FontGroup *fg, CPUCell *first_cpu_cell, GPUCell *first_gpu_cell, index_type num_cells, ssize_t font_idx, bool pua_space_ligature, bool center_glyph, int cursor_offset, DisableLigature disable_ligature_strategy) {
+    bool ok;
+    shape_run(first_cpu_cell, first_gpu_cell, num_cells, &fg->fonts[font_idx], disable_ligature_strategy == DISABLE_LIGATURES_ALWAYS);
+    if (pua_space_ligature) collapse_pua_space_ligature(num_cells);
+    else if (cursor_offset > -1) { // false if DISABLE_LIGATURES_NEVER
+        index_type left, right;
+        split_run_at_offset(cursor_offset, &left, &right);
+        if (right > left) {
+            ok = true;
+            if (left) {
+                shape_run(first_cpu_cell, first_gpu_cell, left, &fg->fonts[font_idx], false);
+                ok = render_groups(fg, &fg->fonts[font_idx], center_glyph) && ok;
+            }
+            shape_run(first_cpu_cell + left, first_gpu_cell + left, right - left, &fg->fonts[font_idx], true);
+            ok = render_groups(fg, &fg->fonts[font_idx], center_glyph) && ok;
+            if (right < num_cells) {
+                shape_run(first_cpu_cell + right, first_gpu_cell + right, num_cells - right, &fg->fonts[font_idx], false);
+                ok = render_groups(fg, &fg->fonts[font_idx], center_glyph) && ok;
+            }
+            return ok;
+        }
+    }
+    return render_groups(fg, &fg->fonts[font_idx], center_glyph);
+}
+
+static SpritePosition*
+ascii_sprite(FontGroup *fg, Font *font, CPUCell *cpu_cell, GPUCell *gpu_cell) {
+    int error = 0;
+    glyph_index glyph = glyph_id_for_codepoint(font->face, cpu_cell->ch);
+    SpritePosition *sp = sprite_position_for(fg, font, &glyph, 1, 0, 1, &error);
+    if (!sp) { sprite_map_set_error(error); PyErr_Print(); return NULL; }
+    if (!sp->rendered) {
+        // this is what shaping would produce for a single glyph with no offsets
+        hb_glyph_info_t info = {.codepoint = glyph};
+        hb_glyph_position_t position = {0};
+        ensure_glyph_render_scratch(16);
+        if (!render_group(fg, 1, 1, cpu_cell, gpu_cell, &info, &position, font, &glyph, 1, false)) return NULL;
+    }
+    font->ascii_sprites[cpu_cell->ch] = sp;
+    return sp;
+}
+
+static bool
+render_ascii_run(FontGroup *fg, CPUCell *first_cpu_cell, GPUCell *first_gpu_cell, index_type num_cells, Font *font) {
+    if (!font->ascii_fast_path) return false;
+    for (index_type i = 0; i < num_cells; i++) {
+        const CPUCell *c = first_cpu_cell + i;
+        if (c->ch < 0x20 || c->ch > 0x7e || c->cc_idx[0] || first_gpu_cell[i].attrs.width != 1) return false;
+    }
+    for (index_type i = 0; i < num_cells; i++) {
+        SpritePosition *sp = font->ascii_sprites[first_cpu_cell[i].ch];
+        if (!sp && !(sp = ascii_sprite(fg, font, first_cpu_cell + i, first_gpu_cell + i))) return false;
+        set_cell_sprite(first_gpu_cell + i, sp);
+    }
+    return true;
+}
+
+// Shaped run cache {{{
+// Maps the text of a run and everything else that affects how it is shaped
+// to the sprites its cells end up with, so that runs that are rendered over
+// and over, such as prompts, are only shaped once.
+
+#define SHAPED_RUN_CACHE_SIZE 4096u
+
+static unsigned
+key_for_run(const CPUCell *cpu_cells, const GPUCell *gpu_cells, index_type num_cells, ssize_t font_idx, bool pua_space_ligature, bool center_glyph, int cursor_offset, DisableLigature disable_ligature_strategy) {
+    const size_t sz = 3 * (size_t)num_cells + 2;
+    if (sz > shaped_run_key_capacity) {
+        shaped_run_key_capacity = MAX(sz, 2 * shaped_run_key_capacity);
+        shaped_run_key = realloc(shaped_run_key, shaped_run_key_capacity * sizeof(shaped_run_key[0]));
+        if (!shaped_run_key) fatal("Out of memory");
+    }
+    char_type *k = shaped_run_key;
+    *k++ = font_idx;
+    *k++ = pua_space_ligature | center_glyph << 1 | (disable_ligature_strategy == DISABLE_LIGATURES_ALWAYS) << 2 | OPT(force_ltr) << 3 | (char_type)(cursor_offset + 1) << 4;
+    for (index_type i = 0; i < num_cells; i++) {
+        *k++ = cpu_cells[i].ch;
+        *k++ = cpu_cells[i].cc_idx[0] | (char_type)cpu_cells[i].cc_idx[1] << 16;
+        *k++ = cpu_cells[i].cc_idx[2] | (char_type)gpu_cells[i].attrs.width << 16;
+    }
+    return sz;
+}
+
+static void
+render_run_with_cache(FontGroup *fg, CPUCell *first_cpu_cell, GPUCell *first_gpu_cell, index_type num_cells, ssize_t font_idx, bool pua_space_ligature, bool center_glyph, int cursor_offset, DisableLigature disable_ligature_strategy) {
+    const unsigned key_sz = key_for_run(first_cpu_cell, first_gpu_cell, num_cells, font_idx, pua_space_ligature, center_glyph, cursor_offset, disable_ligature_strategy);
+    ShapedRun *r = find_shaped_run(&fg->shaped_run_cache, shaped_run_key, key_sz);
+    if (r) {
+        shaped_run_cache_stats.hits++;
+        for (index_type i = 0; i < num_cells; i++) set_sprite(first_gpu_cell + i, r->sprites[3*i], r->sprites[3*i+1], r->sprites[3*i+2]);
+        return;
+    }
+    shaped_run_cache_stats.misses++;
+    // Runs where some cells did not get a sprite, for instance because the
+    // sprite map is full, are not cached, so they are retried next time
+    if (!shape_and_render_run(fg, first_cpu_cell, first_gpu_cell, num_cells, font_idx, pua_space_ligature, center_glyph, cursor_offset, disable_ligature_strategy)) return;
+    r = add_shaped_run(&fg->shaped_run_cache, shaped_run_key, key_sz, num_cells, SHAPED_RUN_CACHE_SIZE);
+    if (!r) return;
+    for (index_type i = 0; i < num_cells; i++) {
+        r->sprites[3*i] = first_gpu_cell[i].sprite_x; r->sprites[3*i+1] = first_gpu_cell[i].sprite_y; r->sprites[3*i+2] = first_gpu_cell[i].sprite_z;
+    }
+}
+// }}}
+
 static void
 render_run(FontGroup *fg, CPUCell *first_cpu_cell, GPUCell *first_gpu_cell, index_type num_cells, ssize_t font_idx, bool pua_space_ligature, bool center_glyph, int cursor_offset, DisableLigature disable_ligature_strategy) {
     switch(font_idx) {
         default:
-            shape_run(first_cpu_cell, first_gpu_cell, num_cells, &fg->fonts[font_idx], disable_ligature_strategy == DISABLE_LIGATURES_ALWAYS);
-            if (pua_space_ligature) collapse_pua_space_ligature(num_cells);
-            else if (cursor_offset > -1) { // false if DISABLE_LIGATURES_NEVER
-                index_type left, right;
-                split_run_at_offset(cursor_offset, &left, &right);
-                if (right > left) {
-                    if (left) {
-                        shape_run(first_cpu_cell, first_gpu_cell, left, &fg->fonts[font_idx], false);
-                        render_groups(fg, &fg->fonts[font_idx], center_glyph);
-                    }
-                        shape_run(first_cpu_cell + left, first_gpu_cell + left, right - left, &fg->fonts[font_idx], true);
-                        render_groups(fg, &fg->fonts[font_idx], center_glyph);
-                    if (right < num_cells) {
-                        shape_run(first_cpu_cell + right, first_gpu_cell + right, num_cells - right, &fg->fonts[font_idx], false);
-                        render_groups(fg, &fg->fonts[font_idx], center_glyph);
-                    }
-                    break;
-                }
-            }
-            render_groups(fg, &fg->fonts[font_idx], center_glyph);
+            if (!pua_space_ligature && render_ascii_run(fg, first_cpu_cell, first_gpu_cell, num_cells, &fg->fonts[font_idx])) break;
+            render_run_with_cache(fg, first_cpu_cell, first_gpu_cell, num_cells, font_idx, pua_space_ligature, center_glyph, cursor_offset, disable_ligature_strategy);
             break;
         case BLANK_FONT:
             while(num_cells--) { set_sprite(first_gpu_cell, 0, 0, 0); first_cpu_cell++; first_gpu_cell++; }
@@ -1543,6 +1936,7 @@ finalize(void) {
     Py_CLEAR(descriptor_for_idx);
     Py_CLEAR(font_feature_settings);
     free_font_groups();
+    stop_rasterizer();
     free(ligature_types);
     if (harfbuzz_buffer) { hb_buffer_destroy(harfbuzz_buffer); harfbuzz_buffer = NULL; }
     free(group_state.groups); group_state.groups = NULL; group_state.groups_capacity = 0;
@@ -1557,6 +1951,7 @@ sprite_map_set_layout(PyObject UNUSED *self, PyObject *args) {
     if(!PyArg_ParseTuple(args, "II", &w, &h)) return NULL;
     if (!num_font_groups) { PyErr_SetString(PyExc_RuntimeError, "must create font group first"); return NULL; }
     sprite_tracker_set_layout(&font_groups->sprite_tracker, w, h);
+    free_shaped_run_hash_table(&font_groups->shaped_run_cache);
     Py_RETURN_NONE;
 }
 
@@ -1599,6 +1994,53 @@ test_render_line(PyObject UNUSED *self, PyObject *args) {
     Py_RETURN_NONE;
 }
 
+static PyObject*
+test_update_cell_data(PyObject UNUSED *self, PyObject *args) {
+    extern PyTypeObject Screen_Type;
+    Screen *screen; int cursor_has_moved = 0;
+    RAII_PY_BUFFER(buf);
+    if (!PyArg_ParseTuple(args, "O!w*|p", &Screen_Type, &screen, &buf, &cursor_has_moved)) return NULL;
+    if (!num_font_groups) { PyErr_SetString(PyExc_RuntimeError, "must create font group first"); return NULL; }
+    if ((size_t)buf.len < sizeof(GPUCell) * screen->lines * screen->columns) { PyErr_SetString(PyExc_ValueError, "buffer too small for screen"); return NULL; }
+    screen_update_cell_data(screen, (FONTS_DATA_HANDLE)font_groups, cursor_has_moved);
+    memcpy(buf.buf, screen->cell_data.cells, sizeof(GPUCell) * screen->lines * screen->columns);
+    unsigned long num_damaged = 0;
+    for (index_type y = 0; y < screen->lines; y++) {
+        const XRange *d = screen->cell_data.damage + y;
+        if (d->x < d->x_limit) num_damaged += d->x_limit - d->x;
+    }
+    return PyLong_FromUnsignedLong(num_damaged);
+}
+
+static PyObject*
+shaped_run_cache_info(PyObject UNUSED *self, PyObject *args) {
+    int reset = 0;
+    if (!PyArg_ParseTuple(args, "|p", &reset)) return NULL;
+    unsigned long long entries = 0;
+    for (size_t i = 0; i < num_font_groups; i++) entries += num_shaped_runs(&font_groups[i].shaped_run_cache);
+    PyObject *ans = Py_BuildValue("{sKsKsK}", "hits", shaped_run_cache_stats.hits, "misses", shaped_run_cache_stats.misses, "entries", entries);
+    if (reset) zero_at_ptr(&shaped_run_cache_stats);
+    return ans;
+}
+
+static PyObject*
+test_threaded_rasterization(PyObject UNUSED *self, PyObject *enabled) {
+    rasterizer.enabled_for_tests = PyObject_IsTrue(enabled);
+    if (rasterizer.enabled_for_tests && raster_pool_size() && start_rasterizer()) Py_RETURN_TRUE;
+    Py_RETURN_FALSE;
+}
+
+static PyObject*
+test_send_rasterized_sprites(PYNOARG) {
+    if (!rasterizer.num_threads) Py_RETURN_NONE;
+    pthread_mutex_lock(&rasterizer.lock);
+    while (rasterizer.pending || rasterizer.num_in_flight) pthread_cond_wait(&rasterizer.work_done, &rasterizer.lock);
+    pthread_mutex_unlock(&rasterizer.lock);
+    bool has_pending;
+    for (size_t i = 0; i < num_font_groups; i++) send_rasterized_sprites((FONTS_DATA_HANDLE)(font_groups + i), &has_pending);
+    Py_RETURN_NONE;
+}
+
 static PyObject*
 concat_cells(PyObject UNUSED *self, PyObject *args) {
     // Concatenate cells returning RGBA data
@@ -1725,6 +2167,10 @@ static PyMethodDef module_methods[] = {
     METHODB(test_shape, METH_VARARGS),
     METHODB(current_fonts, METH_NOARGS),
     METHODB(test_render_line, METH_VARARGS),
+    METHODB(test_update_cell_data, METH_VARARGS),
+    METHODB(shaped_run_cache_info, METH_VARARGS),
+    METHODB(test_threaded_rasterization, METH_O),
+    METHODB(test_send_rasterized_sprites, METH_NOARGS),
     METHODB(get_fallback_font, METH_VARARGS),
     {NULL, NULL, 0, NULL}        /* Sentinel */
 };
@@ -33,10 +33,16 @@ PyObject* face_from_descriptor(PyObject*, FONTS_DATA_HANDLE);
 PyObject* iter_fallback_faces(FONTS_DATA_HANDLE fgh, ssize_t *idx);
 bool face_equals_descriptor(PyObject *face_, PyObject *descriptor);
 const char* postscript_name_for_face(const PyObject*);
+// Rendering glyphs on other threads. Backends return NULL if the face cannot
+// be used for that, the clone is passed to render_glyphs_in_cells() in place
+// of the face.
+void* clone_face_for_thread(PyObject *face);
+void free_face_clone(void *clone);
 
 void sprite_tracker_current_layout(FONTS_DATA_HANDLE data, unsigned int *x, unsigned int *y, unsigned int *z);
 void render_alpha_mask(const uint8_t *alpha_mask, pixel* dest, Region *src_rect, Region *dest_rect, size_t src_stride, size_t dest_stride);
 void render_line(FONTS_DATA_HANDLE, Line *line, index_type lnum, Cursor *cursor, DisableLigature);
+bool send_rasterized_sprites(FONTS_DATA_HANDLE, bool *has_pending);
 void sprite_tracker_set_limits(size_t max_texture_size, size_t max_array_len);
 typedef void (*free_extra_data_func)(void*);
 StringCanvas render_simple_text_impl(PyObject *s, const char *text, unsigned int baseline);
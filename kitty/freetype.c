@@ -36,6 +36,7 @@ typedef struct {
     void *extra_data;
     free_extra_data_func free_extra_data;
     float apple_leading;
+    bool is_thread_clone;
 } Face;
 PyTypeObject Face_Type;
 
@@ -103,6 +104,7 @@ load_glyph(Face *self, int glyph_index, int load_type) {
     int flags = get_load_flags(self->hinting, self->hintstyle, load_type);
     int error = FT_Load_Glyph(self->face, glyph_index, flags);
     if (error) {
+        if (self->is_thread_clone) return false;
         char buf[256];
         snprintf(buf, sizeof(buf) - 1, "Failed to load glyph_index=%d load_type=%d, with error:", glyph_index, load_type);
         set_freetype_error(buf, error); return false;
@@ -164,11 +166,11 @@ set_font_size(Face *self, FT_F26Dot6 char_width, FT_F26Dot6 char_height, FT_UInt
             }
             if (strike_index > -1) {
                 error = FT_Select_Size(self->face, strike_index);
-                if (error) { set_freetype_error("Failed to set char size for non-scalable font, with error:", error); return false; }
+                if (error) { if (!self->is_thread_clone) set_freetype_error("Failed to set char size for non-scalable font, with error:", error); return false; }
                 return true;
             }
         }
-        set_freetype_error("Failed to set char size, with error:", error);
+        if (!self->is_thread_clone) set_freetype_error("Failed to set char size, with error:", error);
         return false;
     }
     return !error;
@@ -275,6 +277,39 @@ face_from_path(const char *path, int index, FONTS_DATA_HANDLE fg) {
     return (PyObject*)ans;
 }
 
+// Copies of faces for rendering on other threads, as an FT_Face must only be
+// used by one thread at a time. They are not Python objects and never call
+// into Python, so they can be used without holding the GIL. They are created
+// and destroyed on the main thread, as FT_New_Face() and FT_Done_Face() must
+// not run concurrently.
+void*
+clone_face_for_thread(PyObject *s) {
+    Face *self = (Face*)s;
+    // colored glyphs and bitmap strikes are left to the main thread
+    if (self->has_color || !self->is_scalable || !PyUnicode_Check(self->path)) return NULL;
+    const char *path = PyUnicode_AsUTF8(self->path);
+    if (!path) { PyErr_Clear(); return NULL; }
+    Face *ans = calloc(1, sizeof(Face));
+    if (!ans) return NULL;
+    if (FT_New_Face(library, path, self->face->face_index, &ans->face)) { free(ans); return NULL; }
+#define CPY(n) ans->n = self->n;
+    CPY(units_per_EM); CPY(ascender); CPY(descender); CPY(height); CPY(max_advance_width); CPY(max_advance_height);
+    CPY(underline_position); CPY(underline_thickness); CPY(strikethrough_position); CPY(strikethrough_thickness);
+    CPY(hinting); CPY(hintstyle); CPY(index); CPY(is_scalable); CPY(has_color); CPY(size_in_pts); CPY(space_glyph_id);
+#undef CPY
+    ans->is_thread_clone = true;
+    if (!set_font_size(ans, self->char_width, self->char_height, self->xdpi, self->ydpi, 0, 0)) { free_face_clone(ans); return NULL; }
+    return ans;
+}
+
+void
+free_face_clone(void *s) {
+    Face *self = s;
+    if (!self) return;
+    if (self->face) FT_Done_Face(self->face);
+    free(self);
+}
+
 static void
 dealloc(Face* self) {
     if (self->harfbuzz_font) hb_font_destroy(self->harfbuzz_font);
@@ -420,12 +455,13 @@ populate_processed_bitmap(FT_GlyphSlotRec *slot, FT_Bitmap *bitmap, ProcessedBit
     ans->bitmap_top = slot->bitmap_top; ans->bitmap_left = slot->bitmap_left;
 }
 
-bool
-freetype_convert_mono_bitmap(FT_Bitmap *src, FT_Bitmap *dest) {
+static int
+convert_mono_bitmap(FT_Bitmap *src, FT_Bitmap *dest) {
+    // Does not call into Python, so it can be used for faces cloned for other threads
     FT_Bitmap_Init(dest);
     // This also sets pixel_mode to FT_PIXEL_MODE_GRAY so we don't have to
     int error = FT_Bitmap_Convert(library, src, dest, 1);
-    if (error) { set_freetype_error("Failed to convert bitmap, with error:", error); return false; }
+    if (error) return error;
     // Normalize gray levels to the range [0..255]
     dest->num_grays = 256;
     unsigned int stride = dest->pitch < 0 ? -dest->pitch : dest->pitch;
@@ -433,6 +469,13 @@ freetype_convert_mono_bitmap(FT_Bitmap *src, FT_Bitmap *dest) {
         // We only have 2 levels
         for (unsigned j = 0; j < (unsigned)dest->width; ++j) dest->buffer[i * stride + j] *= 255;
     }
+    return 0;
+}
+
+bool
+freetype_convert_mono_bitmap(FT_Bitmap *src, FT_Bitmap *dest) {
+    int error = convert_mono_bitmap(src, dest);
+    if (error) { set_freetype_error("Failed to convert bitmap, with error:", error); return false; }
     return true;
 }
 
@@ -444,7 +487,8 @@ render_bitmap(Face *self, int glyph_id, ProcessedBitmap *ans, unsigned int cell_
     // Embedded bitmap glyph?
     if (self->face->glyph->bitmap.pixel_mode == FT_PIXEL_MODE_MONO) {
         FT_Bitmap bitmap;
-        freetype_convert_mono_bitmap(&self->face->glyph->bitmap, &bitmap);
+        int error = convert_mono_bitmap(&self->face->glyph->bitmap, &bitmap);
+        if (error && !self->is_thread_clone) set_freetype_error("Failed to convert bitmap, with error:", error);
         populate_processed_bitmap(self->face->glyph, &bitmap, ans, true);
         FT_Bitmap_Done(library, &bitmap);
     } else {
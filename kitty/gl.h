@@ -50,6 +50,7 @@ ssize_t alloc_vao_buffer(ssize_t vao_idx, GLsizeiptr size, size_t bufnum, GLenum
 void* alloc_and_map_vao_buffer(ssize_t vao_idx, GLsizeiptr size, size_t bufnum, GLenum usage, GLenum access);
 void unmap_vao_buffer(ssize_t vao_idx, size_t bufnum);
 void* map_vao_buffer(ssize_t vao_idx, size_t bufnum, GLenum access);
+void update_vao_buffer(ssize_t vao_idx, size_t bufnum, GLintptr offset, GLsizeiptr size, const void *data);
 void bind_program(int program);
 void bind_vertex_array(ssize_t vao_idx);
 void bind_vao_uniform_buffer(ssize_t vao_idx, size_t bufnum, GLuint block_index);
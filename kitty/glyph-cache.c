@@ -89,3 +89,55 @@ free_glyph_properties_hash_table(GlyphProperties **head_) {
         free(s);
     }
 }
+
+typedef struct ShapedRunItem {
+    ShapedRunHead
+    UT_hash_handle hh;
+    char_type key[];
+} ShapedRunItem;
+
+ShapedRun*
+find_shaped_run(ShapedRun **head_, const char_type *key, unsigned key_sz) {
+    ShapedRunItem **head = (ShapedRunItem**)head_, *p;
+    const unsigned key_sz_bytes = key_sz * sizeof(char_type);
+    HASH_FIND(hh, *head, key, key_sz_bytes, p);
+    if (p) {
+        // move to the end of the list, items are evicted from the start
+        HASH_DEL(*head, p);
+        HASH_ADD(hh, *head, key, key_sz_bytes, p);
+    }
+    return (ShapedRun*)p;
+}
+
+ShapedRun*
+add_shaped_run(ShapedRun **head_, const char_type *key, unsigned key_sz, unsigned num_cells, unsigned max_count) {
+    ShapedRunItem **head = (ShapedRunItem**)head_, *p;
+    while (*head && HASH_COUNT(*head) >= max_count) {
+        p = *head;  // the least recently used item
+        HASH_DEL(*head, p);
+        free(p);
+    }
+    const unsigned key_sz_bytes = key_sz * sizeof(char_type);
+    p = calloc(1, sizeof(ShapedRunItem) + key_sz_bytes + 3 * num_cells * sizeof(sprite_index));
+    if (!p) return NULL;
+    memcpy(p->key, key, key_sz_bytes);
+    p->num_cells = num_cells;
+    p->sprites = (sprite_index*)(p->key + key_sz);
+    HASH_ADD(hh, *head, key, key_sz_bytes, p);
+    return (ShapedRun*)p;
+}
+
+unsigned
+num_shaped_runs(ShapedRun **head_) {
+    ShapedRunItem **head = (ShapedRunItem**)head_;
+    return HASH_COUNT(*head);
+}
+
+void
+free_shaped_run_hash_table(ShapedRun **head_) {
+    ShapedRunItem **head = (ShapedRunItem**)head_, *s, *tmp;
+    HASH_ITER(hh, *head, s, tmp) {
+        HASH_DEL(*head, s);
+        free(s);
+    }
+}
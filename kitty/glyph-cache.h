@@ -33,3 +33,18 @@ typedef struct GlyphProperties {
 void free_glyph_properties_hash_table(GlyphProperties **head);
 GlyphProperties*
 find_or_create_glyph_properties(GlyphProperties **head, unsigned glyph);
+
+#define ShapedRunHead \
+    unsigned num_cells; \
+    sprite_index *sprites;
+
+typedef struct ShapedRun {
+    ShapedRunHead
+} ShapedRun;
+
+void free_shaped_run_hash_table(ShapedRun **head);
+unsigned num_shaped_runs(ShapedRun **head);
+ShapedRun*
+find_shaped_run(ShapedRun **head, const char_type *key, unsigned key_sz);
+ShapedRun*
+add_shaped_run(ShapedRun **head, const char_type *key, unsigned key_sz, unsigned num_cells, unsigned max_count);
@@ -5,14 +5,108 @@
  * Distributed under terms of the GPL3 license.
  */
 
+#define EXTRA_INIT { \
+    register_at_exit_cleanup_func(HISTORY_CLEANUP_FUNC, stop_compressor); \
+    if (PyModule_AddFunctions(module, module_methods) != 0) return false; \
+}
 #include "wcswidth.h"
 #include "lineops.h"
 #include "charsets.h"
 #include <structmember.h>
-#include "ringbuf.h"
+#include "disk-cache.h"
+#include "safe-wrappers.h"
+#include "threading.h"
+#include "cleanup.h"
+#include <sys/mman.h>
 
 extern PyTypeObject Line_Type;
 #define SEGMENT_SIZE 2048
+#define SEARCH_INDEX_BUCKETS 4096u
+#define SEARCH_BLOCK_LINES (SEGMENT_SIZE / 32)
+#define LINE_WRAPPED (1u << 31)
+
+static size_t
+segment_cells_size(HistoryBuf *self) { return self->xnum * SEGMENT_SIZE * (sizeof(CPUCell) + sizeof(GPUCell)); }
+
+// Pool of segment cells {{{
+// The cells of segments are allocated with mmap() so that pages are committed
+// only as they are first written. Freed cells are kept in a process wide pool
+// from which they are reused by any buffer with the same number of columns, so
+// windows that repeatedly clear and refill their scrollback do not keep
+// creating and destroying large mappings. The pages of cells freed when a
+// buffer is cleared or destroyed are given back to the system with
+// MADV_DONTNEED, after which they read as zeros, so they need not be cleared
+// when reused. Those of a couple of cells freed by compressing a segment are
+// kept, as they are needed again as soon as another segment is decompressed.
+// The pool is shared with the parse worker threads, hence the lock.
+
+#define MAX_POOLED_SEGMENT_CELLS 32
+#define MAX_WARM_SEGMENT_CELLS 2
+
+typedef struct {
+    void *cells;
+    size_t sz;
+    bool warm;  // its pages have not been given back
+    bool zeroed;  // its pages were given back, so they read as zeros
+} PooledCells;
+
+static struct {
+    PooledCells items[MAX_POOLED_SEGMENT_CELLS];
+    size_t count, num_warm;
+    pthread_mutex_t lock;
+} cells_pool = {.lock=PTHREAD_MUTEX_INITIALIZER};
+
+static void*
+get_pooled_cells(size_t sz, bool zero) {
+    // Warm cells are left for decompressing segments, which overwrite all the cells
+    PooledCells ans = {0};
+    pthread_mutex_lock(&cells_pool.lock);
+    size_t found = cells_pool.count;
+    for (size_t i = cells_pool.count; i-- > 0;) {
+        if (cells_pool.items[i].sz != sz) continue;
+        found = i;
+        if (cells_pool.items[i].warm != zero) break;
+    }
+    if (found < cells_pool.count) {
+        ans = cells_pool.items[found];
+        if (ans.warm) cells_pool.num_warm--;
+        cells_pool.items[found] = cells_pool.items[--cells_pool.count];
+    }
+    pthread_mutex_unlock(&cells_pool.lock);
+    if (ans.cells && zero && !ans.zeroed) memset(ans.cells, 0, sz);
+    return ans.cells;
+}
+
+static void
+alloc_segment_cells(HistoryBuf *self, HistoryBufSegment *s, bool zero) {
+    const size_t sz = segment_cells_size(self);
+    void *cells = get_pooled_cells(sz, zero);
+    if (!cells) {
+        cells = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (cells == MAP_FAILED) fatal("Out of memory allocating new history buffer segment");
+    }
+    s->cpu_cells = cells;
+    s->gpu_cells = (GPUCell*)(s->cpu_cells + self->xnum * SEGMENT_SIZE);
+}
+
+static void
+free_segment_cells(HistoryBuf *self, HistoryBufSegment *s, bool keep_pages) {
+    if (!s->cpu_cells) return;
+    const size_t sz = segment_cells_size(self);
+    bool pooled = false;
+    pthread_mutex_lock(&cells_pool.lock);
+    if (cells_pool.count < MAX_POOLED_SEGMENT_CELLS) {
+        const bool warm = keep_pages && cells_pool.num_warm < MAX_WARM_SEGMENT_CELLS;
+        const bool zeroed = !warm && madvise(s->cpu_cells, sz, MADV_DONTNEED) == 0;
+        cells_pool.items[cells_pool.count++] = (PooledCells){.cells=s->cpu_cells, .sz=sz, .warm=warm, .zeroed=zeroed};
+        if (warm) cells_pool.num_warm++;
+        pooled = true;
+    }
+    pthread_mutex_unlock(&cells_pool.lock);
+    if (!pooled) munmap(s->cpu_cells, sz);
+    s->cpu_cells = NULL; s->gpu_cells = NULL;
+}
+// }}}
 
 static void
 add_segment(HistoryBuf *self) {
@@ -20,19 +114,649 @@ add_segment(HistoryBuf *self) {
     self->segments = realloc(self->segments, sizeof(HistoryBufSegment) * self->num_segments);
     if (self->segments == NULL) fatal("Out of memory allocating new history buffer segment");
     HistoryBufSegment *s = self->segments + self->num_segments - 1;
-    const size_t cpu_cells_size = self->xnum * SEGMENT_SIZE * sizeof(CPUCell);
-    const size_t gpu_cells_size = self->xnum * SEGMENT_SIZE * sizeof(GPUCell);
-    s->cpu_cells = calloc(1, cpu_cells_size + gpu_cells_size + SEGMENT_SIZE * sizeof(LineAttrs));
-    if (!s->cpu_cells) fatal("Out of memory allocating new history buffer segment");
-    s->gpu_cells = (GPUCell*)(((uint8_t*)s->cpu_cells) + cpu_cells_size);
-    s->line_attrs = (LineAttrs*)(((uint8_t*)s->gpu_cells) + gpu_cells_size);
+    memset(s, 0, sizeof(HistoryBufSegment));
+    alloc_segment_cells(self, s, true);
+    // line attributes are kept separately so they can be changed without decompressing the cells
+    s->line_attrs = calloc(SEGMENT_SIZE, sizeof(LineAttrs));
+    if (!s->line_attrs) fatal("Out of memory allocating new history buffer segment");
+    s->search_index = calloc(SEARCH_INDEX_BUCKETS, sizeof(s->search_index[0]));
+    if (!s->search_index) fatal("Out of memory allocating new history buffer segment");
+    s->line_lengths = calloc(SEGMENT_SIZE, sizeof(s->line_lengths[0]));
+    if (!s->line_lengths) fatal("Out of memory allocating new history buffer segment");
+}
+
+static void finish_compression(HistoryBuf *self, HistoryBufSegment *s, bool keep);
+
+static void
+free_segment(HistoryBuf *self, HistoryBufSegment *s) {
+    if (s->compression) finish_compression(self, s, false);
+    if (s->compressed_cells && !s->cpu_cells) { self->compressed.segments--; self->compressed.bytes -= s->compressed_cells_sz; }
+    if (s->spilled) { self->spill.segments--; self->spill.bytes -= s->compressed_cells_sz; }
+    free_segment_cells(self, s, false);
+    free(s->compressed_cells); free(s->line_attrs); free(s->search_index); free(s->line_lengths);
+    memset(s, 0, sizeof(HistoryBufSegment));
+}
+
+// Compression of cold segments {{{
+// Only the NUM_HOT_HISTORY_SEGMENTS most recently used segments are kept as
+// plain arrays of cells, the others are compressed, see use_segment() for
+// when that happens. Most lines end in a run of
+// identical cells, such as blanks, so each line is stored as the number of
+// cells before that run, followed by those cells and a single copy of the
+// repeated cell. The colors and attributes of the cells are stored as runs,
+// as most lines have only a few of them. This is about as fast as memcpy()
+// and typically shrinks scrollback several fold. Note that pointers to the
+// cells of a line remain valid only until cells from NUM_HOT_HISTORY_SEGMENTS
+// other segments are used.
+//
+// Lines of plain ASCII text with a single set of colors and attributes and
+// no hyperlinks or combining characters, which is most lines of typical
+// logs, are stored more compactly still, as one byte per character and a
+// single copy of the colors and attributes, plus one for cells with no text.
+//
+// The sprite positions of cells are never stored, instead lines are marked
+// dirty when decompressed, so that render_line() calculates them again when
+// the line is scrolled into view.
+
+#define COMPACT_LINE (1u << 31)
+
+typedef struct {
+    color_type fg, bg, decoration_fg;
+    CellAttrs attrs;  // without next_char_was_wrapped in compact lines, where it is stored once for the line
+} CellFormat;
+
+typedef struct {
+    index_type count;
+    CellFormat fmt;
+} CellFormatRun;
+
+static bool
+same_cell_format(const GPUCell *a, const GPUCell *b) {
+    return a->fg == b->fg && a->bg == b->bg && a->decoration_fg == b->decoration_fg && a->attrs.val == b->attrs.val;
+}
+
+typedef struct {
+    CellFormat text, blank;
+    bool last_char_was_wrapped;
+} CompactLine;
+
+static bool
+has_compact_format(const GPUCell *gpu, CellFormat *fmt, bool *seen) {
+    CellAttrs attrs = gpu->attrs;
+    attrs.next_char_was_wrapped = 0;
+    if (!*seen) {
+        *seen = true;
+        *fmt = (CellFormat){.fg=gpu->fg, .bg=gpu->bg, .decoration_fg=gpu->decoration_fg, .attrs=attrs};
+        return true;
+    }
+    return gpu->fg == fmt->fg && gpu->bg == fmt->bg && gpu->decoration_fg == fmt->decoration_fg && attrs.val == fmt->attrs.val;
+}
+
+static bool
+is_compact_line(const CPUCell *cpu, const GPUCell *gpu, index_type xnum, CompactLine *ans) {
+    static const combining_type no_cc[arraysz(cpu->cc_idx)] = {0};
+    *ans = (CompactLine){.last_char_was_wrapped=gpu[xnum-1].attrs.next_char_was_wrapped};
+    bool seen_text = false, seen_blank = false;
+    for (index_type x = 0; x < xnum; x++) {
+        if (cpu[x].ch > 0x7f || cpu[x].hyperlink_id || memcmp(cpu[x].cc_idx, no_cc, sizeof(no_cc)) != 0) return false;
+        if (!(cpu[x].ch ? has_compact_format(gpu + x, &ans->text, &seen_text) : has_compact_format(gpu + x, &ans->blank, &seen_blank))) return false;
+    }
+    return true;
+}
+
+static size_t
+encode_line(const CPUCell *cpu, const GPUCell *gpu, index_type xnum, uint8_t *p, size_t space) {
+    // Returns the number of bytes written to p or zero if they would not be less than space
+    const uint8_t *start = p;
+    const index_type last = xnum - 1;
+    index_type n = last;
+    CompactLine cl;
+    if (is_compact_line(cpu, gpu, xnum, &cl)) {
+        while (n && cpu[n - 1].ch == cpu[last].ch) n--;
+        if (sizeof(n) + sizeof(cl) + n + 1 >= space) return 0;
+        const index_type header = n | COMPACT_LINE;
+        memcpy(p, &header, sizeof(header)); p += sizeof(header);
+        memcpy(p, &cl, sizeof(cl)); p += sizeof(cl);
+        for (index_type x = 0; x <= n; x++) *(p++) = cpu[x].ch;
+        return p - start;
+    }
+    while (n && memcmp(cpu + n - 1, cpu + last, sizeof(CPUCell)) == 0 && same_cell_format(gpu + n - 1, gpu + last)) n--;
+    const size_t cpu_sz = (n + 1) * sizeof(CPUCell);
+    if (sizeof(n) + cpu_sz + sizeof(index_type) >= space) return 0;
+    memcpy(p, &n, sizeof(n)); p += sizeof(n);
+    memcpy(p, cpu, cpu_sz); p += cpu_sz;
+    uint8_t *num_runs_at = p; p += sizeof(index_type);
+    index_type num_runs = 0;
+    for (index_type x = 0; x <= n; num_runs++) {
+        const GPUCell *g = gpu + x;
+        CellFormatRun run = {.fmt={.fg=g->fg, .bg=g->bg, .decoration_fg=g->decoration_fg, .attrs=g->attrs}};
+        while (x <= n && same_cell_format(gpu + x, g)) { x++; run.count++; }
+        if ((size_t)(p - start) + sizeof(run) >= space) return 0;
+        memcpy(p, &run, sizeof(run)); p += sizeof(run);
+    }
+    memcpy(num_runs_at, &num_runs, sizeof(num_runs));
+    return p - start;
+}
+
+static const uint8_t*
+decode_line(const uint8_t *p, CPUCell *cpu, GPUCell *gpu, index_type xnum) {
+    // Returns a pointer to the end of the encoded line
+    index_type n;
+    memcpy(&n, p, sizeof(n)); p += sizeof(n);
+    if (n & COMPACT_LINE) {
+        n &= ~COMPACT_LINE;
+        CompactLine cl;
+        memcpy(&cl, p, sizeof(cl)); p += sizeof(cl);
+        for (index_type x = 0; x < xnum; x++) {
+            const char_type ch = p[MIN(x, n)];
+            const CellFormat *fmt = ch ? &cl.text : &cl.blank;
+            cpu[x] = (CPUCell){.ch=ch};
+            gpu[x] = (GPUCell){.fg=fmt->fg, .bg=fmt->bg, .decoration_fg=fmt->decoration_fg, .attrs=fmt->attrs};
+        }
+        gpu[xnum - 1].attrs.next_char_was_wrapped = cl.last_char_was_wrapped;
+        return p + n + 1;
+    }
+    memcpy(cpu, p, (n + 1) * sizeof(CPUCell)); p += (n + 1) * sizeof(CPUCell);
+    index_type num_runs, x = 0;
+    memcpy(&num_runs, p, sizeof(num_runs)); p += sizeof(num_runs);
+    for (index_type r = 0; r < num_runs; r++) {
+        CellFormatRun run;
+        memcpy(&run, p, sizeof(run)); p += sizeof(run);
+        const GPUCell g = {.fg=run.fmt.fg, .bg=run.fmt.bg, .decoration_fg=run.fmt.decoration_fg, .attrs=run.fmt.attrs};
+        for (index_type end = x + run.count; x < end; x++) gpu[x] = g;
+    }
+    for (x = n + 1; x < xnum; x++) { cpu[x] = cpu[n]; gpu[x] = gpu[n]; }
+    return p;
+}
+
+static const uint8_t*
+skip_line(const uint8_t *p) {
+    // Returns a pointer to the end of the encoded line
+    index_type n, num_runs;
+    memcpy(&n, p, sizeof(n)); p += sizeof(n);
+    if (n & COMPACT_LINE) return p + sizeof(CompactLine) + (n & ~COMPACT_LINE) + 1;
+    p += (n + 1) * sizeof(CPUCell);
+    memcpy(&num_runs, p, sizeof(num_runs));
+    return p + sizeof(num_runs) + num_runs * sizeof(CellFormatRun);
+}
+
+static uint8_t*
+compress_cells(const CPUCell *cpu, const GPUCell *gpu, index_type xnum, size_t *sz) {
+    // Returns NULL if the cells of the segment are incompressible. Only reads
+    // the cells, so it can run on any thread.
+    const size_t raw_sz = xnum * SEGMENT_SIZE * (sizeof(CPUCell) + sizeof(GPUCell));
+    uint8_t *buf = malloc(raw_sz), *p = buf;
+    if (!buf) return NULL;
+    for (index_type y = 0; y < SEGMENT_SIZE; y++) {
+        const size_t n = encode_line(cpu + y * xnum, gpu + y * xnum, xnum, p, raw_sz - (p - buf));
+        if (!n) { free(buf); return NULL; }
+        p += n;
+    }
+    *sz = p - buf;
+    uint8_t *ans = realloc(buf, *sz);
+    return ans ? ans : buf;
 }
 
 static void
-free_segment(HistoryBufSegment *s) {
-    free(s->cpu_cells); memset(s, 0, sizeof(HistoryBufSegment));
+set_compressed_cells(HistoryBuf *self, HistoryBufSegment *s, uint8_t *data, size_t sz) {
+    s->compressed_cells = data; s->compressed_cells_sz = sz;
+    free_segment_cells(self, s, true);
+    self->compressed.segments++; self->compressed.bytes += sz;
 }
 
+static void index_segment(HistoryBuf *self, index_type seg_num);
+static void index_lines(uint32_t *search_index, const CPUCell *cpu, const GPUCell *gpu, index_type xnum, index_type first, index_type limit, char_type *text);
+static index_type segment_lines(HistoryBuf *self, index_type seg_num);
+
+static void
+compress_segment(HistoryBuf *self, HistoryBufSegment *s) {
+    // the cells are needed to index the lines, so that is done first
+    index_segment(self, s - self->segments);
+    size_t sz;
+    uint8_t *data = compress_cells(s->cpu_cells, s->gpu_cells, self->xnum, &sz);
+    if (data) set_compressed_cells(self, s, data, sz);
+}
+
+static void
+decode_segment_cells(HistoryBuf *self, HistoryBufSegment *s, const uint8_t *p) {
+    alloc_segment_cells(self, s, false);
+    for (index_type y = 0; y < SEGMENT_SIZE; y++) {
+        p = decode_line(p, s->cpu_cells + y * self->xnum, s->gpu_cells + y * self->xnum, self->xnum);
+        s->line_attrs[y].has_dirty_text = true;  // the sprite positions have to be recalculated
+    }
+}
+
+static void
+decompress_segment(HistoryBuf *self, HistoryBufSegment *s) {
+    decode_segment_cells(self, s, s->compressed_cells);
+    self->compressed.segments--; self->compressed.bytes -= s->compressed_cells_sz;
+    free(s->compressed_cells); s->compressed_cells = NULL; s->compressed_cells_sz = 0;
+}
+
+// When the buffer is full, adding a line overwrites the oldest one, so a
+// compressed segment is reached by the newest line only when all its lines
+// are the oldest ones. Its compressed cells are then kept while the lines are
+// overwritten, each line being skipped, or decoded only if its text is needed
+// for the pager history, as it is overwritten. All the remaining lines are
+// decoded if any of them is used before then.
+
+static bool
+is_overwriting(const HistoryBufSegment *s) { return s->cpu_cells && s->compressed_cells; }
+
+static void
+stop_overwriting(HistoryBufSegment *s) {
+    free(s->compressed_cells); s->compressed_cells = NULL; s->compressed_cells_sz = 0;
+    s->overwritten = 0; s->compressed_pos = 0;
+}
+
+static void
+finish_overwriting(HistoryBuf *self, HistoryBufSegment *s) {
+    const uint8_t *p = s->compressed_cells + s->compressed_pos;
+    for (index_type y = s->overwritten; y < SEGMENT_SIZE; y++) {
+        p = decode_line(p, s->cpu_cells + y * self->xnum, s->gpu_cells + y * self->xnum, self->xnum);
+        s->line_attrs[y].has_dirty_text = true;
+    }
+    stop_overwriting(s);
+}
+
+static const uint8_t* map_spilled_segment(HistoryBuf *self, HistoryBufSegment *s);
+static void lose_spilled_segment(HistoryBuf *self, HistoryBufSegment *s);
+static void enforce_memory_limit(HistoryBuf *self, HistoryBufSegment *s);
+
+static void
+start_overwriting(HistoryBuf *self, HistoryBufSegment *s) {
+    if (s->spilled) {
+        const uint8_t *data = map_spilled_segment(self, s);
+        if (!data) { lose_spilled_segment(self, s); return; }
+        uint8_t *copy = malloc(s->compressed_cells_sz);
+        if (!copy) fatal("Out of memory reading scrollback spill file");
+        memcpy(copy, data, s->compressed_cells_sz);
+        munmap((void*)data, s->compressed_cells_sz);
+        self->spill.segments--; self->spill.bytes -= s->compressed_cells_sz;
+        s->spilled = false; s->compressed_cells = copy;
+    } else {
+        self->compressed.segments--; self->compressed.bytes -= s->compressed_cells_sz;
+    }
+    alloc_segment_cells(self, s, false);
+    s->overwritten = 0; s->compressed_pos = 0;
+}
+
+static void
+overwrite_oldest_line(HistoryBuf *self, index_type idx, bool needs_text) {
+    HistoryBufSegment *s = self->segments + idx / SEGMENT_SIZE;
+    const index_type y = idx % SEGMENT_SIZE;
+    if (!s->cpu_cells) {
+        // if the oldest line is not the first of the segment the segment also has newer lines
+        if (y) return;
+        start_overwriting(self, s);
+        if (!s->compressed_cells) return;
+    } else if (!s->compressed_cells || y != s->overwritten) return;
+    const uint8_t *p = s->compressed_cells + s->compressed_pos;
+    p = needs_text ? decode_line(p, s->cpu_cells + y * self->xnum, s->gpu_cells + y * self->xnum, self->xnum) : skip_line(p);
+    s->compressed_pos = p - s->compressed_cells;
+    // the last segment can have fewer than SEGMENT_SIZE lines
+    if (++s->overwritten >= MIN((index_type)SEGMENT_SIZE, self->ynum - (idx - y))) stop_overwriting(s);
+}
+// }}}
+
+// Background compression {{{
+// Segments that are no longer hot are compressed on a background thread when
+// the child is idle, see historybuf_compress_cold_segments(), or when more than
+// MAX_COLD_SEGMENTS of them are waiting, so that the lines being added are
+// never held up by compression. Lines not yet in the search index are indexed
+// at the same time. A segment that is used while it is being compressed simply
+// stays uncompressed, the cells are not changed until the compression is done.
+// The same thread converts the lines queued for the pager history, see
+// convert_in_background().
+
+#define MAX_COLD_SEGMENTS NUM_HOT_HISTORY_SEGMENTS
+
+typedef struct CompressionJob {
+    const CPUCell *cpu_cells;
+    const GPUCell *gpu_cells;
+    index_type xnum, num_lines;
+    // the result, NULL if the cells are incompressible
+    uint8_t *compressed_cells;
+    size_t compressed_cells_sz;
+    // when not NULL the index of the num_lines lines is rebuilt, in this and search_text
+    uint32_t *search_index;
+    char_type *search_text;
+    bool running, done;
+    struct CompressionJob *next;
+} CompressionJob;
+
+typedef struct ConversionJob {
+    // the pending lines of a pager history, buf[start:end], the job owns buf
+    uint8_t *buf;
+    size_t start, end;
+    // the result, the text as written to a pager history of the same maximum size
+    PagerHistoryBuf *text;
+    // when true the text replaces the pager history rather than being appended to it
+    bool replaces;
+    bool running, done;
+    struct ConversionJob *next;
+} ConversionJob;
+
+static struct {
+    pthread_t thread;
+    bool started, failed, shutting_down;
+    pthread_mutex_t lock;
+    pthread_cond_t work_available, work_done;
+    CompressionJob *queue, *queue_tail;
+    ConversionJob *conversions, *conversions_tail;
+} compressor = {.lock=PTHREAD_MUTEX_INITIALIZER, .work_available=PTHREAD_COND_INITIALIZER, .work_done=PTHREAD_COND_INITIALIZER};
+
+static void convert_pending_lines(PagerHistoryBuf *ph, const uint8_t *p, const uint8_t *end);
+
+static void*
+compressor_thread(void *data UNUSED) {
+    set_thread_name("KittyHistCompr");
+    pthread_mutex_lock(&compressor.lock);
+    while (!compressor.shutting_down) {
+        // conversions first, the lines they hold use more memory than the cells of a segment
+        ConversionJob *conversion = compressor.conversions;
+        if (conversion) {
+            if (!(compressor.conversions = conversion->next)) compressor.conversions_tail = NULL;
+            conversion->running = true;
+            pthread_mutex_unlock(&compressor.lock);
+            convert_pending_lines(conversion->text, conversion->buf + conversion->start, conversion->buf + conversion->end);
+            pthread_mutex_lock(&compressor.lock);
+            conversion->running = false; conversion->done = true;
+            pthread_cond_broadcast(&compressor.work_done);
+            continue;
+        }
+        CompressionJob *job = compressor.queue;
+        if (!job) { pthread_cond_wait(&compressor.work_available, &compressor.lock); continue; }
+        if (!(compressor.queue = job->next)) compressor.queue_tail = NULL;
+        job->running = true;
+        pthread_mutex_unlock(&compressor.lock);
+        if (job->search_index) index_lines(job->search_index, job->cpu_cells, job->gpu_cells, job->xnum, 0, job->num_lines, job->search_text);
+        job->compressed_cells = compress_cells(job->cpu_cells, job->gpu_cells, job->xnum, &job->compressed_cells_sz);
+        pthread_mutex_lock(&compressor.lock);
+        job->running = false; job->done = true;
+        pthread_cond_broadcast(&compressor.work_done);
+    }
+    pthread_mutex_unlock(&compressor.lock);
+    return NULL;
+}
+
+static void
+stop_compressor(void) {
+    pthread_mutex_lock(&compressor.lock);
+    const bool started = compressor.started;
+    compressor.shutting_down = true;
+    pthread_cond_broadcast(&compressor.work_available);
+    pthread_mutex_unlock(&compressor.lock);
+    if (started) pthread_join(compressor.thread, NULL);
+    compressor.started = false;
+}
+
+static bool
+start_compressor(void) {
+    // Must be called with the lock held, returns false if the thread is not available
+    if (!compressor.started && !compressor.failed && !compressor.shutting_down) {
+        int ret = pthread_create(&compressor.thread, NULL, compressor_thread, NULL);
+        if (ret == 0) compressor.started = true;
+        else {
+            compressor.failed = true;
+            log_error("Failed to start the scrollback compression thread with error: %s, compressing on the main thread", strerror(ret));
+        }
+    }
+    return compressor.started;
+}
+
+static void
+compress_in_background(HistoryBuf *self, HistoryBufSegment *s) {
+    const index_type num_lines = segment_lines(self, s - self->segments);
+    const bool needs_index = s->indexed_lines < num_lines;
+    CompressionJob *job = calloc(1, sizeof(CompressionJob) + (needs_index ? SEARCH_INDEX_BUCKETS * sizeof(uint32_t) + self->xnum * sizeof(char_type) : 0));
+    if (!job) return;  // it will be tried again when the child is idle
+    *job = (CompressionJob){.cpu_cells=s->cpu_cells, .gpu_cells=s->gpu_cells, .xnum=self->xnum, .num_lines=num_lines};
+    if (needs_index) {
+        job->search_index = (uint32_t*)(job + 1);
+        job->search_text = (char_type*)(job->search_index + SEARCH_INDEX_BUCKETS);
+    }
+    pthread_mutex_lock(&compressor.lock);
+    const bool queued = start_compressor();
+    if (queued) {
+        if (compressor.queue_tail) compressor.queue_tail->next = job;
+        else compressor.queue = job;
+        compressor.queue_tail = job;
+        pthread_cond_signal(&compressor.work_available);
+    }
+    pthread_mutex_unlock(&compressor.lock);
+    if (queued) { s->compression = job; self->compressed.in_progress++; }
+    else { free(job); compress_segment(self, s); enforce_memory_limit(self, s); }
+}
+
+static void
+finish_compression(HistoryBuf *self, HistoryBufSegment *s, bool keep) {
+    // Wait for the compression of s to finish and use the result if keep is
+    // true, compressing the cells now if that has not yet started. The index
+    // is used in any case, the cells being unchanged.
+    CompressionJob *job = s->compression;
+    pthread_mutex_lock(&compressor.lock);
+    if (!job->running && !job->done) {
+        CompressionJob *prev = NULL;
+        for (CompressionJob *q = compressor.queue; q != job; prev = q, q = q->next);
+        if (prev) prev->next = job->next;
+        else compressor.queue = job->next;
+        if (compressor.queue_tail == job) compressor.queue_tail = prev;
+    }
+    while (job->running) pthread_cond_wait(&compressor.work_done, &compressor.lock);
+    pthread_mutex_unlock(&compressor.lock);
+    s->compression = NULL; self->compressed.in_progress--;
+    if (job->done) {
+        if (job->search_index) {
+            memcpy(s->search_index, job->search_index, SEARCH_INDEX_BUCKETS * sizeof(s->search_index[0]));
+            s->indexed_lines = job->num_lines;
+        }
+        if (keep && job->compressed_cells) {
+            set_compressed_cells(self, s, job->compressed_cells, job->compressed_cells_sz);
+            enforce_memory_limit(self, s);
+        } else free(job->compressed_cells);
+    } else if (keep) { compress_segment(self, s); enforce_memory_limit(self, s); }
+    free(job);
+}
+
+static bool
+compression_done(const CompressionJob *job) {
+    pthread_mutex_lock(&compressor.lock);
+    const bool ans = job->done;
+    pthread_mutex_unlock(&compressor.lock);
+    return ans;
+}
+
+static bool
+is_hot(HistoryBuf *self, index_type seg_num) {
+    for (index_type i = 0; i < self->num_hot_segments; i++) if (self->hot_segments[i] == seg_num) return true;
+    return false;
+}
+
+static bool
+is_cold(HistoryBuf *self, index_type seg_num) {
+    // Whether the segment is uncompressed, not being compressed and not hot
+    const HistoryBufSegment *s = self->segments + seg_num;
+    return s->cpu_cells && !s->compressed_cells && !s->compression && !is_hot(self, seg_num);
+}
+
+static void
+compress_cold(HistoryBuf *self, bool wait) {
+    if (self->compressed.in_progress) {
+        for (index_type i = 0; i < self->num_segments; i++) {
+            HistoryBufSegment *s = self->segments + i;
+            if (s->compression && (wait || compression_done(s->compression))) finish_compression(self, s, true);
+        }
+    }
+    if (self->compressed.has_cold) {
+        self->compressed.has_cold = false;
+        for (index_type i = 0; i < self->num_segments; i++) {
+            if (is_cold(self, i)) {
+                if (wait) { compress_segment(self, self->segments + i); enforce_memory_limit(self, self->segments + i); }
+                else compress_in_background(self, self->segments + i);
+            }
+        }
+    }
+}
+
+bool
+historybuf_compress_cold_segments(HistoryBuf *self) {
+    // Called when the child is idle, returns true while segments are being
+    // compressed, in which case this should be called again a little later
+    compress_cold(self, false);
+    return self->compressed.in_progress > 0;
+}
+
+static void
+make_cold(HistoryBuf *self, index_type seg_num) {
+    // Called when seg_num stops being hot
+    HistoryBufSegment *s = self->segments + seg_num;
+    if (is_overwriting(s)) finish_overwriting(self, s);
+    index_type num_cold = 0;
+    for (index_type i = 0; i < self->num_segments && num_cold < MAX_COLD_SEGMENTS; i++) if (is_cold(self, i)) num_cold++;
+    if (num_cold >= MAX_COLD_SEGMENTS) compress_in_background(self, s);
+    else self->compressed.has_cold = true;
+}
+// }}}
+
+// Spilling to disk {{{
+// When the memory used by the segments of a buffer exceeds its memory_limit,
+// newly compressed segments are moved to an unlinked file in the cache
+// directory. Every segment has its own slot in the file, so reading it back
+// is a single mmap() of that slot. Slots are written with pwrite() rather
+// than through a mapping so that running out of disk space is an error
+// rather than a SIGBUS.
+
+static char *spill_dir = NULL;
+
+static bool
+init_spill_dir(void) {
+    // Must be called with the GIL held, spilling itself happens without it during parallel parsing
+    if (spill_dir) return true;
+    RAII_PyObject(kc, PyImport_ImportModule("kitty.constants"));
+    if (!kc) return false;
+    RAII_PyObject(cache_dir, PyObject_CallMethod(kc, "cache_dir", NULL));
+    if (!cache_dir) return false;
+    if (!PyUnicode_Check(cache_dir)) { PyErr_SetString(PyExc_TypeError, "cache_dir() did not return a string"); return false; }
+    spill_dir = strdup(PyUnicode_AsUTF8(cache_dir));
+    if (!spill_dir) { PyErr_NoMemory(); return false; }
+    return true;
+}
+
+static size_t
+segments_memory(HistoryBuf *self) {
+    const size_t uncompressed = self->num_segments - self->compressed.segments - self->spill.segments;
+    return uncompressed * segment_cells_size(self) + self->compressed.bytes;
+}
+
+static void
+spill_failed(HistoryBuf *self, const char *what) {
+    log_error("Failed to %s scrollback spill file with error: %s, keeping scrollback in memory", what, strerror(errno));
+    self->spill.failed = true;
+}
+
+static bool
+write_to_spill_file(HistoryBuf *self, const uint8_t *data, size_t sz, off_t offset) {
+    while (sz) {
+        ssize_t n = pwrite(self->spill.fd, data, sz, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n; sz -= n; offset += n;
+    }
+    return true;
+}
+
+static void
+spill_segment(HistoryBuf *self, HistoryBufSegment *s) {
+    if (self->spill.failed || !spill_dir) return;
+    if (self->spill.fd < 0) {
+        self->spill.fd = open_cache_file(spill_dir);
+        if (self->spill.fd < 0) { spill_failed(self, "create"); return; }
+    }
+    if (s->spill_capacity < s->compressed_cells_sz) {
+        // Grow geometrically so that a segment does not leave behind many outgrown slots
+        static size_t page_size = 0;
+        if (!page_size) page_size = sysconf(_SC_PAGESIZE);
+        size_t capacity = MAX(s->compressed_cells_sz, 2 * s->spill_capacity);
+        capacity = MIN(segment_cells_size(self), capacity);
+        capacity = (capacity + page_size - 1) & ~(page_size - 1);
+        if (ftruncate(self->spill.fd, self->spill.file_size + capacity) != 0) { spill_failed(self, "resize"); return; }
+        s->spill_offset = self->spill.file_size; s->spill_capacity = capacity;
+        self->spill.file_size += capacity;
+    }
+    if (!write_to_spill_file(self, s->compressed_cells, s->compressed_cells_sz, s->spill_offset)) { spill_failed(self, "write to"); return; }
+    self->compressed.segments--; self->compressed.bytes -= s->compressed_cells_sz;
+    self->spill.segments++; self->spill.bytes += s->compressed_cells_sz;
+    free(s->compressed_cells); s->compressed_cells = NULL;
+    s->spilled = true;
+}
+
+static void
+enforce_memory_limit(HistoryBuf *self, HistoryBufSegment *s) {
+    if (self->spill.memory_limit && s->compressed_cells && segments_memory(self) > self->spill.memory_limit) spill_segment(self, s);
+}
+
+static const uint8_t*
+map_spilled_segment(HistoryBuf *self, HistoryBufSegment *s) {
+    // Returns NULL if the segment cannot be read, in which case its lines are lost
+    void *ans = mmap(NULL, s->compressed_cells_sz, PROT_READ, MAP_SHARED, self->spill.fd, s->spill_offset);
+    if (ans == MAP_FAILED) {
+        log_error("Failed to map scrollback spill file with error: %s, some scrollback lines are lost", strerror(errno));
+        return NULL;
+    }
+    return ans;
+}
+
+static void
+lose_spilled_segment(HistoryBuf *self, HistoryBufSegment *s) {
+    // The lines of a segment that could not be read back are replaced by blank
+    // lines and, as after spill_failed(), the scrollback is kept in memory
+    self->spill.failed = true;
+    self->spill.segments--; self->spill.bytes -= s->compressed_cells_sz;
+    s->spilled = false; s->compressed_cells_sz = 0;
+    alloc_segment_cells(self, s, true);
+    memset(s->line_lengths, 0, SEGMENT_SIZE * sizeof(s->line_lengths[0]));
+    for (index_type y = 0; y < SEGMENT_SIZE; y++) s->line_attrs[y] = (LineAttrs){.has_dirty_text=true};
+}
+
+static void
+unspill_segment(HistoryBuf *self, HistoryBufSegment *s) {
+    // The slot in the file is kept for when the segment is spilled again
+    const uint8_t *data = map_spilled_segment(self, s);
+    if (!data) { lose_spilled_segment(self, s); return; }
+    decode_segment_cells(self, s, data);
+    munmap((void*)data, s->compressed_cells_sz);
+    self->spill.segments--; self->spill.bytes -= s->compressed_cells_sz;
+    s->spilled = false; s->compressed_cells_sz = 0;
+}
+// }}}
+
+// LRU of hot segments {{{
+
+static void
+use_segment(HistoryBuf *self, index_type seg_num, index_type y) {
+    // Move seg_num to the front of the hot segments, decompressing it if
+    // needed, so that the cells of its line y can be used
+    HistoryBufSegment *s = self->segments + seg_num;
+    if (UNLIKELY(is_overwriting(s)) && y >= s->overwritten) finish_overwriting(self, s);
+    if (LIKELY(self->num_hot_segments && self->hot_segments[0] == seg_num)) return;
+    index_type i = 1;
+    while (i < self->num_hot_segments && self->hot_segments[i] != seg_num) i++;
+    if (i >= self->num_hot_segments) {
+        if (s->compression) finish_compression(self, s, false);
+        else if (s->compressed_cells && !s->cpu_cells) decompress_segment(self, s);
+        else if (s->spilled) unspill_segment(self, s);
+        if (self->num_hot_segments < NUM_HOT_HISTORY_SEGMENTS) self->num_hot_segments++;
+        else make_cold(self, self->hot_segments[NUM_HOT_HISTORY_SEGMENTS - 1]);
+        i = self->num_hot_segments - 1;
+    }
+    memmove(self->hot_segments + 1, self->hot_segments, i * sizeof(self->hot_segments[0]));
+    self->hot_segments[0] = seg_num;
+}
+// }}}
+
 static index_type
 segment_for(HistoryBuf *self, index_type y) {
     index_type seg_num = y / SEGMENT_SIZE;
@@ -41,30 +765,49 @@ segment_for(HistoryBuf *self, index_type y) {
     return seg_num;
 }
 
-#define seg_ptr(which, stride) { \
+#define seg_ptr(which, stride, needs_cells) { \
     index_type seg_num = segment_for(self, y); \
+    if (needs_cells) use_segment(self, seg_num, y - seg_num * SEGMENT_SIZE); \
     y -= seg_num * SEGMENT_SIZE; \
     return self->segments[seg_num].which + y * stride; \
 }
 
 static CPUCell*
 cpu_lineptr(HistoryBuf *self, index_type y) {
-    seg_ptr(cpu_cells, self->xnum);
+    seg_ptr(cpu_cells, self->xnum, true);
 }
 
 static GPUCell*
 gpu_lineptr(HistoryBuf *self, index_type y) {
-    seg_ptr(gpu_cells, self->xnum);
+    seg_ptr(gpu_cells, self->xnum, true);
 }
 
 
 static LineAttrs*
 attrptr(HistoryBuf *self, index_type y) {
-    seg_ptr(line_attrs, 1);
+    seg_ptr(line_attrs, 1, false);
 }
 
-static size_t
-initial_pagerhist_ringbuf_sz(size_t pagerhist_sz) { return MIN(1024u * 1024u, pagerhist_sz); }
+static index_type*
+lengthptr(HistoryBuf *self, index_type y) {
+    seg_ptr(line_lengths, 1, false);
+}
+
+static void
+set_line_length(HistoryBuf *self, index_type y, index_type limit) {
+    // Cells at or beyond limit are blank
+    const CPUCell *cpu = cpu_lineptr(self, y);
+    while (limit && cpu[limit - 1].ch == BLANK_CHAR) limit--;
+    *lengthptr(self, y) = limit | (gpu_lineptr(self, y)[self->xnum - 1].attrs.next_char_was_wrapped ? LINE_WRAPPED : 0);
+}
+
+// Pager history storage {{{
+// The pager history is stored as a list of fixed size chunks. Text is appended
+// to the last chunk and trimmed from the start of the first one, which is
+// dropped whole once all its text has been trimmed, so the text is never
+// copied or reallocated. Use pagerhist_span() to access it in place.
+
+#define PAGERHIST_CHUNK_SIZE (64u * 1024u)
 
 static PagerHistoryBuf*
 alloc_pagerhist(size_t pagerhist_sz) {
@@ -72,59 +815,224 @@ alloc_pagerhist(size_t pagerhist_sz) {
     if (!pagerhist_sz) return NULL;
     ph = calloc(1, sizeof(PagerHistoryBuf));
     if (!ph) return NULL;
-    size_t sz = initial_pagerhist_ringbuf_sz(pagerhist_sz);
-    ph->ringbuf = ringbuf_new(sz);
-    if (!ph->ringbuf) { free(ph); return NULL; }
     ph->maximum_size = pagerhist_sz;
+    ph->chunk_size = MIN(PAGERHIST_CHUNK_SIZE, pagerhist_sz);
     return ph;
 }
 
+static void
+release_pagerhist_chunk(PagerHistoryBuf *ph, uint8_t *chunk) {
+    // keep one chunk around to avoid a malloc() per chunk while scrolling
+    if (ph->spare_chunk) free(chunk);
+    else ph->spare_chunk = chunk;
+}
+
+static void
+pagerhist_reset(PagerHistoryBuf *ph) {
+    for (size_t i = 0; i < ph->num_chunks; i++) release_pagerhist_chunk(ph, ph->chunks[i]);
+    ph->num_chunks = 0; ph->start = 0; ph->end = 0; ph->bytes_used = 0;
+}
+
+static void
+drop_pending_pagerhist(PagerHistoryBuf *ph) {
+    ph->pending.start = 0; ph->pending.end = 0; ph->pending.num_lines = 0; ph->pending.min_text_sz = 0;
+}
+
+static void finish_conversion(PagerHistoryBuf *ph, bool keep);
+
+static void
+dealloc_pagerhist(PagerHistoryBuf *ph) {
+    if (!ph) return;
+    while (ph->num_converting) finish_conversion(ph, false);
+    pagerhist_reset(ph);
+    free(ph->spare_chunk); free(ph->chunks); free(ph->pending.buf);
+    free(ph);
+}
+
 static void
 free_pagerhist(HistoryBuf *self) {
-    if (self->pagerhist && self->pagerhist->ringbuf) ringbuf_free((ringbuf_t*)&self->pagerhist->ringbuf);
-    free(self->pagerhist);
+    dealloc_pagerhist(self->pagerhist);
     self->pagerhist = NULL;
 }
 
 static bool
-pagerhist_extend(PagerHistoryBuf *ph, size_t minsz) {
-    size_t buffer_size = ringbuf_capacity(ph->ringbuf);
-    if (buffer_size >= ph->maximum_size) return false;
-    size_t newsz = MIN(ph->maximum_size, buffer_size + MAX(1024u * 1024u, minsz));
-    ringbuf_t newbuf = ringbuf_new(newsz);
-    if (!newbuf) return false;
-    size_t count = ringbuf_bytes_used(ph->ringbuf);
-    if (count) ringbuf_copy(newbuf, ph->ringbuf, count);
-    ringbuf_free((ringbuf_t*)&ph->ringbuf);
-    ph->ringbuf = newbuf;
+pagerhist_add_chunk(PagerHistoryBuf *ph) {
+    if (ph->num_chunks >= ph->chunks_capacity) {
+        const size_t capacity = MAX(8u, 2 * ph->chunks_capacity);
+        uint8_t **chunks = realloc(ph->chunks, capacity * sizeof(chunks[0]));
+        if (!chunks) return false;
+        ph->chunks = chunks; ph->chunks_capacity = capacity;
+    }
+    uint8_t *chunk = ph->spare_chunk ? ph->spare_chunk : malloc(ph->chunk_size);
+    if (!chunk) return false;
+    ph->spare_chunk = NULL;
+    ph->chunks[ph->num_chunks++] = chunk;
+    ph->end = 0;
+    return true;
+}
+
+static void
+pagerhist_trim(PagerHistoryBuf *ph, size_t amt) {
+    // Remove amt bytes from the start
+    while (amt && ph->num_chunks) {
+        const size_t in_first = (ph->num_chunks > 1 ? ph->chunk_size : ph->end) - ph->start, n = MIN(amt, in_first);
+        ph->start += n; ph->bytes_used -= n; amt -= n;
+        if (n < in_first) break;
+        release_pagerhist_chunk(ph, ph->chunks[0]);
+        memmove(ph->chunks, ph->chunks + 1, --ph->num_chunks * sizeof(ph->chunks[0]));
+        ph->start = 0;
+        if (!ph->num_chunks) ph->end = 0;
+    }
+}
+
+static size_t
+pagerhist_span(const PagerHistoryBuf *ph, size_t i, const uint8_t **data) {
+    // The i-th contiguous span of the text, returns zero once past the end
+    if (i >= ph->num_chunks) return 0;
+    const size_t start = i ? 0 : ph->start, end = i + 1 < ph->num_chunks ? ph->chunk_size : ph->end;
+    *data = ph->chunks[i] + start;
+    return end - start;
+}
+
+static bool
+pagerhist_write_bytes(PagerHistoryBuf *ph, const uint8_t *buf, size_t sz) {
+    if (sz > ph->maximum_size) return false;
+    while (sz) {
+        if ((!ph->num_chunks || ph->end >= ph->chunk_size) && !pagerhist_add_chunk(ph)) return false;
+        const size_t n = MIN(sz, ph->chunk_size - ph->end);
+        memcpy(ph->chunks[ph->num_chunks - 1] + ph->end, buf, n);
+        ph->end += n; ph->bytes_used += n; buf += n; sz -= n;
+    }
+    if (ph->bytes_used > ph->maximum_size) {
+        pagerhist_trim(ph, ph->bytes_used - ph->maximum_size);
+        // dont leave a partial UTF-8 character at the start
+        while (ph->num_chunks && (ph->chunks[0][ph->start] & 0xc0) == 0x80) pagerhist_trim(ph, 1);
+    }
     return true;
 }
 
 static void
 pagerhist_clear(HistoryBuf *self) {
-    if (self->pagerhist && self->pagerhist->ringbuf) {
-        ringbuf_reset(self->pagerhist->ringbuf);
-        size_t rsz = initial_pagerhist_ringbuf_sz(self->pagerhist->maximum_size);
-        void *rbuf = ringbuf_new(rsz);
-        if (rbuf) {
-            ringbuf_free((ringbuf_t*)&self->pagerhist->ringbuf);
-            self->pagerhist->ringbuf = rbuf;
-        }
+    PagerHistoryBuf *ph = self->pagerhist;
+    if (ph) {
+        while (ph->num_converting) finish_conversion(ph, false);
+        drop_pending_pagerhist(ph);
+        pagerhist_reset(ph);
+        // release the memory
+        free(ph->spare_chunk); ph->spare_chunk = NULL;
+        free(ph->chunks); ph->chunks = NULL; ph->chunks_capacity = 0;
     }
 }
+// }}}
+
+// Lazy rewrapping {{{
+// Rewrapping all the lines when the screen is resized is slow for large
+// buffers, so historybuf_rewrap_lazily() instead moves them into reflow.src and
+// only counts the lines they occupy once rewrapped, using the line lengths.
+// These become the oldest lines of the buffer, they take up no space in its
+// segments and are all rewrapped as soon as any one of them is needed.
+
+static void rewrap_pending_lines(HistoryBuf *self);
+
+static void
+free_storage(HistoryBuf *self) {
+    for (size_t i = 0; i < self->num_segments; i++) free_segment(self, self->segments + i);
+    free(self->segments); self->segments = NULL; self->num_segments = 0;
+    if (self->spill.fd > -1) safe_close(self->spill.fd, __FILE__, __LINE__);
+    self->spill.fd = -1;
+    if (self->reflow.src) { free_storage(self->reflow.src); free(self->reflow.src); }
+    memset(&self->reflow, 0, sizeof(self->reflow));
+}
+
+static void
+swap_storage(HistoryBuf *a, HistoryBuf *b) {
+#define swap_field(f) { uint8_t t[sizeof(a->f)]; memcpy(t, &a->f, sizeof(t)); memcpy(&a->f, &b->f, sizeof(t)); memcpy(&b->f, t, sizeof(t)); }
+    swap_field(num_segments); swap_field(segments); swap_field(hot_segments); swap_field(num_hot_segments);
+    swap_field(compressed); swap_field(spill); swap_field(start_of_data); swap_field(count); swap_field(reflow);
+#undef swap_field
+}
 
 static HistoryBuf*
-create_historybuf(PyTypeObject *type, unsigned int xnum, unsigned int ynum, unsigned int pagerhist_sz) {
+detach_storage(HistoryBuf *self) {
+    // Move the lines of self into a new buffer that is not a python object, leaving self empty
+    HistoryBuf *ans = calloc(1, sizeof(HistoryBuf));
+    if (!ans) fatal("Out of memory allocating history buffer");
+    ans->xnum = self->xnum; ans->ynum = self->ynum;
+    ans->spill.fd = -1; ans->spill.memory_limit = self->spill.memory_limit;
+    swap_storage(self, ans);
+    add_segment(self);
+    return ans;
+}
+
+static void
+drop_reflow_src(HistoryBuf *self) {
+    HistoryBuf *src = self->reflow.src;
+    memset(&self->reflow, 0, sizeof(self->reflow));
+    free_storage(src); free(src);
+}
+
+static size_t
+logical_line_length(HistoryBuf *src, index_type *y, index_type limit) {
+    // The number of cells in the lines from *y, counting from the oldest line,
+    // up to and including the first line that does not wrap
+    size_t ans = 0;
+    while (*y < limit) {
+        const index_type len = *lengthptr(src, (src->start_of_data + (*y)++) % src->ynum);
+        if (!(len & LINE_WRAPPED)) return ans + len;
+        ans += src->xnum;
+    }
+    return ans;
+}
+
+static index_type
+lines_for_cells(size_t cells, index_type xnum) { return cells > xnum ? (cells + xnum - 1) / xnum : 1; }
+
+static size_t
+rewrapped_line_count(HistoryBuf *src, index_type limit, size_t skip, index_type xnum) {
+    size_t ans = 0;
+    for (index_type y = 0; y < limit; skip = 0) ans += lines_for_cells(logical_line_length(src, &y, limit) - skip, xnum);
+    return ans;
+}
+
+static void
+skip_oldest_pending_line(HistoryBuf *self) {
+    // Remove the oldest line that has yet to be rewrapped, without rewrapping it
+    HistoryBuf *src = self->reflow.src;
+    if (!self->reflow.group_lines) {
+        index_type y = 0;
+        self->reflow.group_cells = logical_line_length(src, &y, src->count);
+        self->reflow.group_lines = y;
+    }
+    if (self->reflow.group_cells - self->reflow.skip > self->xnum) self->reflow.skip += self->xnum;
+    else {
+        src->start_of_data = (src->start_of_data + self->reflow.group_lines) % src->ynum;
+        src->count -= self->reflow.group_lines;
+        self->reflow.skip = 0; self->reflow.group_lines = 0;
+    }
+}
+// }}}
+
+static HistoryBuf*
+create_historybuf(PyTypeObject *type, unsigned int xnum, unsigned int ynum, unsigned int pagerhist_sz, unsigned int memory_limit) {
     if (xnum == 0 || ynum == 0) {
         PyErr_SetString(PyExc_ValueError, "Cannot create an empty history buffer");
         return NULL;
     }
+    if (memory_limit && !init_spill_dir()) {
+        PyErr_Print();
+        log_error("Failed to get the cache directory, scrollback will not be spilled to disk");
+        memory_limit = 0;
+    }
     HistoryBuf *self = (HistoryBuf *)type->tp_alloc(type, 0);
     if (self != NULL) {
         self->xnum = xnum;
         self->ynum = ynum;
+        self->spill.fd = -1;
+        self->spill.memory_limit = memory_limit;
         self->num_segments = 0;
         add_segment(self);
+        self->search_text = malloc(xnum * sizeof(self->search_text[0]));
+        if (!self->search_text) fatal("Out of memory allocating history buffer");
         self->line = alloc_line();
         self->line->xnum = xnum;
         self->pagerhist = alloc_pagerhist(pagerhist_sz);
@@ -134,17 +1042,17 @@ create_historybuf(PyTypeObject *type, unsigned int xnum, unsigned int ynum, unsi
 
 static PyObject *
 new(PyTypeObject *type, PyObject *args, PyObject UNUSED *kwds) {
-    unsigned int xnum = 1, ynum = 1, pagerhist_sz = 0;
-    if (!PyArg_ParseTuple(args, "II|I", &ynum, &xnum, &pagerhist_sz)) return NULL;
-    HistoryBuf *ans = create_historybuf(type, xnum, ynum, pagerhist_sz);
+    unsigned int xnum = 1, ynum = 1, pagerhist_sz = 0, memory_limit = 0;
+    if (!PyArg_ParseTuple(args, "II|II", &ynum, &xnum, &pagerhist_sz, &memory_limit)) return NULL;
+    HistoryBuf *ans = create_historybuf(type, xnum, ynum, pagerhist_sz, memory_limit);
     return (PyObject*)ans;
 }
 
 static void
 dealloc(HistoryBuf* self) {
     Py_CLEAR(self->line);
-    for (size_t i = 0; i < self->num_segments; i++) free_segment(self->segments + i);
-    free(self->segments);
+    free_storage(self);
+    free(self->search_text);
     free_pagerhist(self);
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
@@ -154,7 +1062,9 @@ index_of(HistoryBuf *self, index_type lnum) {
     // The index (buffer position) of the line with line number lnum
     // This is reverse indexing, i.e. lnum = 0 corresponds to the *last* line in the buffer.
     if (self->count == 0) return 0;
-    index_type idx = self->count - 1 - MIN(self->count - 1, lnum);
+    if (UNLIKELY(self->reflow.num_lines) && lnum >= self->count - self->reflow.num_lines) rewrap_pending_lines(self);
+    const index_type stored = self->count - self->reflow.num_lines;
+    index_type idx = stored - 1 - MIN(stored - 1, lnum);
     return (self->start_of_data + idx) % self->ynum;
 }
 
@@ -168,10 +1078,11 @@ init_line(HistoryBuf *self, index_type num, Line *l) {
         l->attrs.is_continued = gpu_lineptr(self, num - 1)[self->xnum-1].attrs.next_char_was_wrapped;
     } else {
         l->attrs.is_continued = false;
-        size_t sz;
-        if (self->pagerhist && self->pagerhist->ringbuf && (sz = ringbuf_bytes_used(self->pagerhist->ringbuf)) > 0) {
-            size_t pos = ringbuf_findchr(self->pagerhist->ringbuf, '\n', sz - 1);
-            if (pos >= sz) l->attrs.is_continued = true;  // ringbuf does not end with a newline
+        if (self->pagerhist && (self->pagerhist->pending.num_lines || self->pagerhist->num_converting)) l->attrs.is_continued = self->pagerhist->pending.last_line_wrapped;
+        else if (self->pagerhist && self->pagerhist->bytes_used) {
+            const PagerHistoryBuf *ph = self->pagerhist;
+            // the pager history does not end with a newline
+            l->attrs.is_continued = ph->chunks[ph->num_chunks - 1][ph->end - 1] != '\n';
         }
     }
 }
@@ -183,6 +1094,7 @@ historybuf_init_line(HistoryBuf *self, index_type lnum, Line *l) {
 
 bool
 history_buf_endswith_wrap(HistoryBuf *self) {
+    if (self->reflow.num_lines && self->reflow.num_lines == self->count) return false;
     return gpu_lineptr(self, index_of(self, 0))[self->xnum-1].attrs.next_char_was_wrapped;
 }
 
@@ -206,76 +1118,435 @@ historybuf_set_line_has_image_placeholders(HistoryBuf *self, index_type y, bool
     attrptr(self, index_of(self, y))->has_image_placeholders = val;
 }
 
-void
-historybuf_clear(HistoryBuf *self) {
-    pagerhist_clear(self);
-    self->count = 0;
-    self->start_of_data = 0;
-    for (size_t i = 1; i < self->num_segments; i++) free_segment(self->segments + i);
-    self->num_segments = 1;
+// Search index {{{
+// Each segment has an index of the trigrams in the text of its lines: for
+// every (hashed) trigram a bitmask of the blocks of SEARCH_BLOCK_LINES lines
+// that contain it. A search only looks at the lines in blocks that contain
+// all the trigrams of the query. Lines are not indexed as they are added but
+// in batches: when their segment is compressed, by a search, or as they are
+// rewrapped. The bits of the blocks starting in a batch are cleared first,
+// and the oldest lines in the last of these blocks indexed again. Matching
+// ignores the case of ASCII letters.
+
+static char_type
+fold_case(char_type ch) { return 'A' <= ch && ch <= 'Z' ? ch + ('a' - 'A') : ch; }
+
+static index_type
+searchable_text(const CPUCell *cpu, const GPUCell *gpu, index_type xnum, char_type *text, index_type *cols) {
+    // The case folded text of a line, without trailing blanks, and optionally the column of each character
+    index_type n = 0, len = 0;
+    bool after_wide_char = false;
+    for (index_type x = 0; x < xnum; x++) {
+        char_type ch = cpu[x].ch;
+        if (!ch) {
+            if (after_wide_char) { after_wide_char = false; continue; }
+            ch = ' ';
+        } else after_wide_char = gpu[x].attrs.width == 2;
+        if (cols) cols[n] = x;
+        text[n++] = fold_case(ch);
+        if (ch != ' ') len = n;
+    }
+    return len;
 }
 
 static bool
-pagerhist_write_bytes(PagerHistoryBuf *ph, const uint8_t *buf, size_t sz) {
-    if (sz > ph->maximum_size) return false;
-    if (!sz) return true;
-    size_t space_in_ringbuf = ringbuf_bytes_free(ph->ringbuf);
-    if (sz > space_in_ringbuf) pagerhist_extend(ph, sz);
-    ringbuf_memcpy_into(ph->ringbuf, buf, sz);
-    return true;
+is_indexed_trigram(const char_type *t) { return t[0] != ' ' || t[1] != ' ' || t[2] != ' '; }
+
+static unsigned
+trigram_bucket(const char_type *t) {
+    return (((t[0] * 31u + t[1]) * 31u + t[2]) * 0x9e3779b1u) >> 20;  // 20 == 32 - log2(SEARCH_INDEX_BUCKETS)
 }
 
-static bool
-pagerhist_ensure_start_is_valid_utf8(PagerHistoryBuf *ph) {
-    uint8_t scratch[8];
-    size_t num = ringbuf_memcpy_from(scratch, ph->ringbuf, arraysz(scratch));
-    uint32_t codep;
-    UTF8State state = UTF8_ACCEPT;
-    size_t count = 0;
-    size_t last_reject_at = 0;
-    while (count < num) {
-        decode_utf8(&state, &codep, scratch[count++]);
-        if (state == UTF8_ACCEPT) break;
-        if (state == UTF8_REJECT) { state = UTF8_ACCEPT; last_reject_at = count; }
-    }
-    if (last_reject_at) {
-        ringbuf_memmove_from(scratch, ph->ringbuf, last_reject_at);
-        return true;
+static void
+index_line_text(uint32_t *search_index, index_type y, const char_type *text, index_type len) {
+    const uint32_t block = 1u << (y / SEARCH_BLOCK_LINES);
+    for (index_type i = 0; i + 2 < len; i++) {
+        if (is_indexed_trigram(text + i)) search_index[trigram_bucket(text + i)] |= block;
     }
-    return false;
+}
+
+static void
+index_lines(uint32_t *search_index, const CPUCell *cpu, const GPUCell *gpu, index_type xnum, index_type first, index_type limit, char_type *text) {
+    // Index the lines first to limit of the cells of a segment, can run on any thread
+    for (index_type y = first; y < limit; y++) {
+        index_line_text(search_index, y, text, searchable_text(cpu + y * xnum, gpu + y * xnum, xnum, text, NULL));
+    }
+}
+
+static index_type
+segment_lines(HistoryBuf *self, index_type seg_num) {
+    // The number of lines at the start of the segment that have been added to the buffer
+    const index_type next = (self->start_of_data + self->count - self->reflow.num_lines) % self->ynum;
+    if (next / SEGMENT_SIZE == seg_num) return next % SEGMENT_SIZE;
+    return MIN((index_type)SEGMENT_SIZE, self->ynum - seg_num * SEGMENT_SIZE);
+}
+
+static void
+index_segment_lines(HistoryBuf *self, index_type seg_num, index_type first, index_type limit) {
+    HistoryBufSegment *s = self->segments + seg_num;
+    if (s->cpu_cells && (!s->compressed_cells || limit <= s->overwritten)) {
+        index_lines(s->search_index, s->cpu_cells, s->gpu_cells, self->xnum, first, limit, self->search_text);
+    } else {
+        for (index_type y = first, idx = seg_num * SEGMENT_SIZE + y; y < limit; y++, idx++) {
+            index_line_text(s->search_index, y, self->search_text, searchable_text(cpu_lineptr(self, idx), gpu_lineptr(self, idx), self->xnum, self->search_text, NULL));
+        }
+    }
+}
+
+static void
+index_segment(HistoryBuf *self, index_type seg_num) {
+    // Index the lines of the segment added since it was last indexed
+    HistoryBufSegment *s = self->segments + seg_num;
+    const index_type limit = segment_lines(self, seg_num);
+    // when the buffer is full the lines from limit on are the oldest ones
+    const index_type end = MIN((index_type)SEGMENT_SIZE, self->ynum - seg_num * SEGMENT_SIZE);
+    const bool has_old_lines = limit < end && self->count - self->reflow.num_lines == self->ynum;
+    if (s->indexed_lines < limit) {
+        uint32_t keep = UINT32_MAX;
+        index_type block = (s->indexed_lines + SEARCH_BLOCK_LINES - 1) / SEARCH_BLOCK_LINES;
+        for (; block * SEARCH_BLOCK_LINES < limit; block++) keep &= ~(1u << block);
+        if (keep != UINT32_MAX) for (unsigned i = 0; i < SEARCH_INDEX_BUCKETS; i++) s->search_index[i] &= keep;
+        index_segment_lines(self, seg_num, s->indexed_lines, limit);
+        // the oldest lines in the last block cleared
+        if (has_old_lines && limit % SEARCH_BLOCK_LINES && !(keep & (1u << (limit / SEARCH_BLOCK_LINES)))) {
+            const index_type cleared_limit = block * SEARCH_BLOCK_LINES;
+            index_segment_lines(self, seg_num, limit, MIN(end, cleared_limit));
+        }
+        s->indexed_lines = limit;
+    }
+    if (has_old_lines) {
+        // which may not have been indexed before the first line was overwritten
+        index_type *indexed = s->indexed_lines > limit ? &s->indexed_lines : &s->old_indexed_lines;
+        if (*indexed < end) {
+            index_segment_lines(self, seg_num, MAX(limit, *indexed), end);
+            *indexed = end;
+        }
+    }
+}
+
+static index_type
+find_in_text(const char_type *text, index_type len, const char_type *query, index_type query_len) {
+    for (index_type i = 0; i + query_len <= len; i++) {
+        if (text[i] == query[0] && memcmp(text + i, query, query_len * sizeof(query[0])) == 0) return i;
+    }
+    return len;
+}
+
+bool
+historybuf_search(HistoryBuf *self, const char_type *query, index_type query_len, index_type lnum, bool backwards, HistorySearchResult *ans) {
+    // Find the first line at or after lnum, going towards older lines if backwards, that contains query
+    rewrap_pending_lines(self);
+    if (!query_len || query_len > self->xnum || lnum >= self->count) return false;
+    char_type *q = malloc(query_len * sizeof(q[0]) + self->xnum * sizeof(index_type));
+    uint32_t *candidates = malloc(self->num_segments * sizeof(candidates[0]));
+    if (!q || !candidates) fatal("Out of memory searching history buffer");
+    index_type *cols = (index_type*)(q + query_len);
+    for (index_type i = 0; i < query_len; i++) q[i] = fold_case(query[i]);
+    for (index_type s = 0; s < self->num_segments; s++) {
+        index_segment(self, s);
+        candidates[s] = UINT32_MAX;
+        for (index_type i = 0; i + 2 < query_len; i++) {
+            if (is_indexed_trigram(q + i)) candidates[s] &= self->segments[s].search_index[trigram_bucket(q + i)];
+        }
+    }
+    bool found = false;
+    for (int64_t n = lnum; 0 <= n && n < self->count; ) {
+        const index_type idx = index_of(self, n), y = idx % SEGMENT_SIZE;
+        if (!(candidates[idx / SEGMENT_SIZE] & (1u << (y / SEARCH_BLOCK_LINES)))) {
+            // skip to the next block, lines are stored from oldest to newest
+            if (backwards) n += y % SEARCH_BLOCK_LINES + 1;
+            else n -= MIN(SEARCH_BLOCK_LINES - y % SEARCH_BLOCK_LINES, self->ynum - idx);
+            continue;
+        }
+        const index_type len = searchable_text(cpu_lineptr(self, idx), gpu_lineptr(self, idx), self->xnum, self->search_text, cols);
+        const index_type pos = find_in_text(self->search_text, len, q, query_len);
+        if (pos < len) {
+            ans->lnum = n; ans->start_x = cols[pos]; ans->end_x = cols[pos + query_len - 1];
+            found = true;
+            break;
+        }
+        n += backwards ? 1 : -1;
+    }
+    free(q); free(candidates);
+    return found;
+}
+// }}}
+
+static void
+clear_segments(HistoryBuf *self) {
+    self->count = 0;
+    self->start_of_data = 0;
+    for (size_t i = 0; i < self->num_segments; i++) free_segment(self, self->segments + i);
+    self->num_segments = 0;
+    self->num_hot_segments = 0;
+    self->compressed.has_cold = false;
+    add_segment(self);
+    if (self->spill.fd > -1 && ftruncate(self->spill.fd, 0) == 0) self->spill.file_size = 0;
+}
+
+void
+historybuf_clear(HistoryBuf *self) {
+    pagerhist_clear(self);
+    if (self->reflow.src) drop_reflow_src(self);
+    clear_segments(self);
 }
 
 static bool
 pagerhist_write_ucs4(PagerHistoryBuf *ph, const Py_UCS4 *buf, size_t sz) {
-    uint8_t scratch[4];
+    // Encode in batches, taking care that no batch is larger than maximum_size
+    // so that, as before, all the text that fits is written
+    uint8_t scratch[4096];
+    const size_t limit = MIN(sizeof(scratch), ph->maximum_size);
+    size_t n = 0;
     for (size_t i = 0; i < sz; i++) {
-        unsigned int num = encode_utf8(buf[i], (char*)scratch);
-        if (!pagerhist_write_bytes(ph, scratch, num)) return false;
+        if (n + 4 > limit) {
+            if (!pagerhist_write_bytes(ph, scratch, n)) return false;
+            n = 0;
+        }
+        n += encode_utf8(buf[i], (char*)scratch + n);
     }
-    return true;
+    return pagerhist_write_bytes(ph, scratch, n);
 }
 
 static void
-pagerhist_push(HistoryBuf *self, ANSIBuf *as_ansi_buf) {
-    PagerHistoryBuf *ph = self->pagerhist;
-    if (!ph) return;
+pagerhist_write_line(PagerHistoryBuf *ph, Line *l, ANSIBuf *as_ansi_buf) {
     const GPUCell *prev_cell = NULL;
-    Line l = {.xnum=self->xnum};
-    init_line(self, self->start_of_data, &l);
-    line_as_ansi(&l, as_ansi_buf, &prev_cell, 0, l.xnum, 0);
+    line_as_ansi(l, as_ansi_buf, &prev_cell, 0, l->xnum, 0);
     pagerhist_write_bytes(ph, (const uint8_t*)"\x1b[m", 3);
     if (pagerhist_write_ucs4(ph, as_ansi_buf->buf, as_ansi_buf->len)) {
         char line_end[2]; size_t num = 0;
         line_end[num++] = '\r';
-        if (!l.gpu_cells[l.xnum - 1].attrs.next_char_was_wrapped) line_end[num++] = '\n';
+        if (!l->gpu_cells[l->xnum - 1].attrs.next_char_was_wrapped) line_end[num++] = '\n';
         pagerhist_write_bytes(ph, (const uint8_t*)line_end, num);
     }
 }
 
+// Deferred conversion {{{
+// Converting lines to ANSI text as they are evicted from the history buffer
+// would dominate the cost of scrolling, so they are instead queued in the
+// encoding used for compressed segments. When the window has no more pending
+// input or when the queue grows too large, the queue is handed over as a batch
+// to the compressor thread, which converts it to text that is appended to the
+// pager history once done. Any batches still being converted are waited for,
+// and the rest of the queue converted, when the pager history is used. Since
+// every line produces at least a known number of bytes, queued lines that
+// would certainly be overwritten by the lines queued after them are dropped
+// without ever being converted.
+
+// The queue is handed over when it uses more memory than the larger of this
+// and twice the size of the pager history
+#define MIN_PENDING_PAGERHIST_LIMIT (8u * 1024u * 1024u)
+
+typedef struct {
+    uint32_t encoded_sz, min_text_sz;
+    index_type xnum;
+    LineAttrs attrs;
+} PendingPagerLine;
+
+static size_t
+min_pagerhist_line_sz(const CPUCell *cpu, index_type xnum) {
+    // A lower bound on the number of bytes pagerhist_write_line() writes, the
+    // SGR reset, the carriage return and one byte per non-blank character
+    size_t ans = 4;
+    for (index_type x = 0; x < xnum; x++) if (cpu[x].ch && cpu[x].ch != ' ') ans++;
+    return ans;
+}
+
+static bool
+line_has_hyperlinks(const CPUCell *cpu, index_type xnum) {
+    for (index_type x = 0; x < xnum; x++) if (cpu[x].hyperlink_id) return true;
+    return false;
+}
+
+static void
+drop_oldest_pending_line(PagerHistoryBuf *ph) {
+    PendingPagerLine pl;
+    memcpy(&pl, ph->pending.buf + ph->pending.start, sizeof(pl));
+    ph->pending.start += sizeof(pl) + pl.encoded_sz;
+    ph->pending.min_text_sz -= pl.min_text_sz;
+    if (!--ph->pending.num_lines) drop_pending_pagerhist(ph);
+}
+
+static void
+convert_pending_lines(PagerHistoryBuf *ph, const uint8_t *p, const uint8_t *end) {
+    // Write the encoded lines in [p, end) to ph, this is also run on the compressor thread
+    ANSIBuf as_ansi_buf = {0};
+    CPUCell *cpu = NULL; GPUCell *gpu = NULL;
+    index_type cells_capacity = 0;
+    while (p < end) {
+        PendingPagerLine pl;
+        memcpy(&pl, p, sizeof(pl)); p += sizeof(pl);
+        if (pl.xnum > cells_capacity) {
+            free(cpu); cpu = malloc(pl.xnum * (sizeof(CPUCell) + sizeof(GPUCell)));
+            if (!cpu) fatal("Out of memory converting lines for the pager history");
+            gpu = (GPUCell*)(cpu + pl.xnum);
+            cells_capacity = pl.xnum;
+        }
+        p = decode_line(p, cpu, gpu, pl.xnum);
+        Line l = {.xnum=pl.xnum, .cpu_cells=cpu, .gpu_cells=gpu, .attrs=pl.attrs};
+        pagerhist_write_line(ph, &l, &as_ansi_buf);
+    }
+    free(cpu); free(as_ansi_buf.buf);
+}
+
+static void
+finish_conversion(PagerHistoryBuf *ph, bool keep) {
+    // Wait for the oldest batch being converted to finish and append its text
+    // if keep is true, converting the lines now if that has not yet started
+    ConversionJob *job = ph->converting[0];
+    pthread_mutex_lock(&compressor.lock);
+    if (!job->running && !job->done) {
+        ConversionJob *prev = NULL;
+        for (ConversionJob *q = compressor.conversions; q != job; prev = q, q = q->next);
+        if (prev) prev->next = job->next;
+        else compressor.conversions = job->next;
+        if (compressor.conversions_tail == job) compressor.conversions_tail = prev;
+    }
+    while (job->running) pthread_cond_wait(&compressor.work_done, &compressor.lock);
+    pthread_mutex_unlock(&compressor.lock);
+    memmove(ph->converting, ph->converting + 1, --ph->num_converting * sizeof(ph->converting[0]));
+    if (keep) {
+        if (job->replaces) pagerhist_reset(ph);
+        if (job->done) {
+            const uint8_t *data;
+            for (size_t i = 0, n; (n = pagerhist_span(job->text, i, &data)); i++) pagerhist_write_bytes(ph, data, n);
+        } else convert_pending_lines(ph, job->buf + job->start, job->buf + job->end);
+    }
+    free(job->buf); dealloc_pagerhist(job->text); free(job);
+}
+
+static bool
+conversion_done(const ConversionJob *job) {
+    pthread_mutex_lock(&compressor.lock);
+    const bool ans = job->done;
+    pthread_mutex_unlock(&compressor.lock);
+    return ans;
+}
+
+static void
+pagerhist_convert_pending(PagerHistoryBuf *ph) {
+    // Convert all the lines yet to be converted, call before using the text
+    if (!ph) return;
+    while (ph->num_converting) finish_conversion(ph, true);
+    if (!ph->pending.num_lines) return;
+    // everything currently in the pager history would be overwritten anyway
+    if (ph->pending.min_text_sz >= ph->maximum_size) pagerhist_reset(ph);
+    convert_pending_lines(ph, ph->pending.buf + ph->pending.start, ph->pending.buf + ph->pending.end);
+    drop_pending_pagerhist(ph);
+}
+
+static void
+convert_in_background(PagerHistoryBuf *ph) {
+    // Hand the pending lines over to the compressor thread, converting them
+    // now if it is not available. Batches that are done are appended first.
+    while (ph->num_converting && conversion_done(ph->converting[0])) finish_conversion(ph, true);
+    if (!ph->pending.num_lines) return;
+    // bound the memory used by the batches when they are queued faster than they are converted
+    if (ph->num_converting >= MAX_PAGERHIST_CONVERSIONS) finish_conversion(ph, true);
+    ConversionJob *job = calloc(1, sizeof(ConversionJob));
+    if (job) *job = (ConversionJob){
+        .buf=ph->pending.buf, .start=ph->pending.start, .end=ph->pending.end, .text=alloc_pagerhist(ph->maximum_size),
+        .replaces=ph->pending.min_text_sz >= ph->maximum_size
+    };
+    bool queued = false;
+    if (job && job->text) {
+        pthread_mutex_lock(&compressor.lock);
+        if ((queued = start_compressor())) {
+            if (compressor.conversions_tail) compressor.conversions_tail->next = job;
+            else compressor.conversions = job;
+            compressor.conversions_tail = job;
+            pthread_cond_signal(&compressor.work_available);
+        }
+        pthread_mutex_unlock(&compressor.lock);
+    }
+    if (queued) {
+        ph->converting[ph->num_converting++] = job;
+        ph->pending.buf = NULL; ph->pending.capacity = 0;
+        drop_pending_pagerhist(ph);
+    } else {
+        if (job) dealloc_pagerhist(job->text);
+        free(job);
+        pagerhist_convert_pending(ph);
+    }
+}
+
+static void
+pagerhist_queue_line(PagerHistoryBuf *ph, Line *l) {
+    // room for the worst case encoding of the line
+    const size_t needed = sizeof(PendingPagerLine) + 2 * sizeof(index_type) + sizeof(CompactLine) + l->xnum * (sizeof(CPUCell) + sizeof(CellFormatRun));
+    if (ph->pending.end + needed > ph->pending.capacity) {
+        const size_t used = ph->pending.end - ph->pending.start;
+        if (ph->pending.start) {
+            memmove(ph->pending.buf, ph->pending.buf + ph->pending.start, used);
+            ph->pending.start = 0; ph->pending.end = used;
+        }
+        // keep at least half the buffer free so that the moves above are amortized
+        if (2 * (used + needed) > ph->pending.capacity) {
+            const size_t capacity = MAX(2 * ph->pending.capacity, 2 * (used + needed));
+            uint8_t *buf = realloc(ph->pending.buf, capacity);
+            if (!buf) fatal("Out of memory queueing lines for the pager history");
+            ph->pending.buf = buf; ph->pending.capacity = capacity;
+        }
+    }
+    uint8_t *p = ph->pending.buf + ph->pending.end;
+    PendingPagerLine pl = {.xnum=l->xnum, .attrs=l->attrs, .min_text_sz=min_pagerhist_line_sz(l->cpu_cells, l->xnum)};
+    pl.encoded_sz = encode_line(l->cpu_cells, l->gpu_cells, l->xnum, p + sizeof(pl), needed - sizeof(pl));
+    memcpy(p, &pl, sizeof(pl));
+    ph->pending.end += sizeof(pl) + pl.encoded_sz;
+    ph->pending.num_lines++;
+    ph->pending.min_text_sz += pl.min_text_sz;
+    ph->pending.last_line_wrapped = l->gpu_cells[l->xnum - 1].attrs.next_char_was_wrapped;
+    PendingPagerLine oldest;
+    while (ph->pending.num_lines > 1) {
+        memcpy(&oldest, ph->pending.buf + ph->pending.start, sizeof(oldest));
+        if (ph->pending.min_text_sz - oldest.min_text_sz < ph->maximum_size) break;
+        drop_oldest_pending_line(ph);
+    }
+    if (ph->pending.end - ph->pending.start > MAX(2 * ph->maximum_size, MIN_PENDING_PAGERHIST_LIMIT)) convert_in_background(ph);
+}
+
+bool
+historybuf_convert_pending_pagerhist(HistoryBuf *self) {
+    // Called when the child is idle, returns true while lines are being
+    // converted in the background, in which case this should be called again
+    // a little later
+    if (!self->pagerhist) return false;
+    convert_in_background(self->pagerhist);
+    return self->pagerhist->num_converting > 0;
+}
+
+static void
+pagerhist_push(HistoryBuf *self, ANSIBuf *as_ansi_buf) {
+    PagerHistoryBuf *ph = self->pagerhist;
+    if (!ph) return;
+    Line l = {.xnum=self->xnum};
+    init_line(self, self->start_of_data, &l);
+    if (as_ansi_buf->active_hyperlink_id || line_has_hyperlinks(l.cpu_cells, l.xnum)) {
+        // hyperlink ids are only valid until the next garbage collection of the hyperlink pool
+        pagerhist_convert_pending(ph);
+        pagerhist_write_line(ph, &l, as_ansi_buf);
+    } else pagerhist_queue_line(ph, &l);
+}
+// }}}
+
 static index_type
 historybuf_push(HistoryBuf *self, ANSIBuf *as_ansi_buf) {
-    index_type idx = (self->start_of_data + self->count) % self->ynum;
+    if (UNLIKELY(self->reflow.num_lines) && self->count == self->ynum) {
+        // the pager history needs the text of the line being removed
+        if (self->pagerhist) rewrap_pending_lines(self);
+        else {
+            skip_oldest_pending_line(self);
+            self->count--;
+            if (!--self->reflow.num_lines) drop_reflow_src(self);
+        }
+    }
+    index_type idx = (self->start_of_data + self->count - self->reflow.num_lines) % self->ynum;
+    if (self->count == self->ynum) overwrite_oldest_line(self, idx, self->pagerhist != NULL);
     init_line(self, idx, self->line);
+    // the line is indexed later, see index_segment()
+    HistoryBufSegment *s = self->segments + idx / SEGMENT_SIZE;
+    if (idx % SEGMENT_SIZE == 0) { s->old_indexed_lines = s->indexed_lines; s->indexed_lines = 0; }
+    else s->indexed_lines = MIN(s->indexed_lines, idx % SEGMENT_SIZE);
     if (self->count == self->ynum) {
         pagerhist_push(self, as_ansi_buf);
         self->start_of_data = (self->start_of_data + 1) % self->ynum;
@@ -288,12 +1559,14 @@ historybuf_add_line(HistoryBuf *self, const Line *line, ANSIBuf *as_ansi_buf) {
     index_type idx = historybuf_push(self, as_ansi_buf);
     copy_line(line, self->line);
     *attrptr(self, idx) = line->attrs;
+    set_line_length(self, idx, self->xnum);
 }
 
 bool
 historybuf_pop_line(HistoryBuf *self, Line *line) {
     if (self->count <= 0) return false;
-    index_type idx = (self->start_of_data + self->count - 1) % self->ynum;
+    if (UNLIKELY(self->reflow.num_lines == self->count)) rewrap_pending_lines(self);
+    index_type idx = (self->start_of_data + self->count - self->reflow.num_lines - 1) % self->ynum;
     init_line(self, idx, line);
     self->count--;
     return true;
@@ -302,7 +1575,12 @@ historybuf_pop_line(HistoryBuf *self, Line *line) {
 static void
 history_buf_set_last_char_as_continuation(HistoryBuf *self, index_type y, bool wrapped) {
     if (self->count > 0) {
-        gpu_lineptr(self, index_of(self, y))[self->xnum-1].attrs.next_char_was_wrapped = wrapped;
+        // the newest line that has yet to be rewrapped does not wrap already
+        if (!wrapped && self->reflow.num_lines && y == self->count - self->reflow.num_lines) return;
+        const index_type idx = index_of(self, y);
+        gpu_lineptr(self, idx)[self->xnum-1].attrs.next_char_was_wrapped = wrapped;
+        index_type *len = lengthptr(self, idx);
+        *len = wrapped ? (*len | LINE_WRAPPED) : (*len & ~LINE_WRAPPED);
     }
 }
 
@@ -350,6 +1628,7 @@ as_ansi(HistoryBuf *self, PyObject *callback) {
     Line l = {.xnum=self->xnum};
     const GPUCell *prev_cell = NULL;
     ANSIBuf output = {0};
+    rewrap_pending_lines(self);
     for(unsigned int i = 0; i < self->count; i++) {
         init_line(self, i, &l);
         line_as_ansi(&l, &output, &prev_cell, 0, l.xnum, 0);
@@ -373,35 +1652,20 @@ end:
 static Line*
 get_line(HistoryBuf *self, index_type y, Line *l) { init_line(self, index_of(self, self->count - y - 1), l); return l; }
 
-static char_type
-pagerhist_remove_char(PagerHistoryBuf *ph, unsigned *count, uint8_t record[8]) {
-    uint32_t codep; UTF8State state = UTF8_ACCEPT;
-    *count = 0;
-    size_t num = ringbuf_bytes_used(ph->ringbuf);
-    while (num--) {
-        record[*count] = ringbuf_move_char(ph->ringbuf);
-        decode_utf8(&state, &codep, record[*count]);
-        *count += 1;
-        if (state == UTF8_REJECT) { codep = 0; break; }
-        if (state == UTF8_ACCEPT) break;
-    }
-    return codep;
-}
-
 static void
 pagerhist_rewrap_to(HistoryBuf *self, index_type cells_in_line) {
     PagerHistoryBuf *ph = self->pagerhist;
-    if (!ph->ringbuf || !ringbuf_bytes_used(ph->ringbuf)) return;
-    PagerHistoryBuf *nph = calloc(sizeof(PagerHistoryBuf), 1);
+    pagerhist_convert_pending(ph);
+    if (!ph->bytes_used) return;
+    PagerHistoryBuf *nph = alloc_pagerhist(ph->maximum_size);
     if (!nph) return;
-    nph->maximum_size = ph->maximum_size;
-    nph->ringbuf = ringbuf_new(MIN(ph->maximum_size, ringbuf_capacity(ph->ringbuf) + 4096));
-    if (!nph->ringbuf) { free(nph); return ; }
     ssize_t ch_width = 0;
-    unsigned count;
+    unsigned count = 0;
     uint8_t record[8];
     index_type num_in_current_line = 0;
     char_type ch;
+    uint32_t codep = 0;
+    UTF8State state = UTF8_ACCEPT;
     WCSState wcs_state;
     initialize_wcs_state(&wcs_state);
 
@@ -414,26 +1678,41 @@ pagerhist_rewrap_to(HistoryBuf *self, index_type cells_in_line) {
     pagerhist_write_bytes(nph, record, count); \
 }
 
-    while (ringbuf_bytes_used(ph->ringbuf)) {
-        ch = pagerhist_remove_char(ph, &count, record);
-        if (ch == '\n') {
-            initialize_wcs_state(&wcs_state);
-            ch_width = 1;
-            WRITE_CHAR();
-            num_in_current_line = 0;
-        } else if (ch != '\r') {
-            ch_width = wcswidth_step(&wcs_state, ch);
-            WRITE_CHAR();
+#define REWRAP_CHAR() { \
+    if (ch == '\n') { \
+        initialize_wcs_state(&wcs_state); \
+        ch_width = 1; \
+        WRITE_CHAR(); \
+        num_in_current_line = 0; \
+    } else if (ch != '\r') { \
+        ch_width = wcswidth_step(&wcs_state, ch); \
+        WRITE_CHAR(); \
+    } \
+    count = 0; \
+}
+
+    const uint8_t *data;
+    for (size_t i = 0, n; (n = pagerhist_span(ph, i, &data)); i++) {
+        for (size_t k = 0; k < n; k++) {
+            record[count++] = data[k];
+            decode_utf8(&state, &codep, data[k]);
+            if (state == UTF8_REJECT) { state = UTF8_ACCEPT; codep = 0; }
+            else if (state != UTF8_ACCEPT) continue;
+            ch = codep;
+            REWRAP_CHAR();
         }
     }
+    if (count) { ch = 0; REWRAP_CHAR(); }  // truncated final character
     free_pagerhist(self);
     self->pagerhist = nph;
+#undef REWRAP_CHAR
 #undef WRITE_CHAR
 }
 
 static PyObject*
 pagerhist_write(HistoryBuf *self, PyObject *what) {
     if (self->pagerhist && self->pagerhist->maximum_size) {
+        pagerhist_convert_pending(self->pagerhist);
         if (PyBytes_Check(what)) pagerhist_write_bytes(self->pagerhist, (const uint8_t*)PyBytes_AS_STRING(what), PyBytes_GET_SIZE(what));
         else if (PyUnicode_Check(what) && PyUnicode_READY(what) == 0) {
             Py_UCS4 *buf = PyUnicode_AsUCS4Copy(what);
@@ -462,15 +1741,16 @@ pagerhist_as_bytes(HistoryBuf *self, PyObject *args) {
     int upto_output_start = 0;
     if (!PyArg_ParseTuple(args, "|p", &upto_output_start)) return NULL;
 #define ph self->pagerhist
-    if (!ph || !ringbuf_bytes_used(ph->ringbuf)) return PyBytes_FromStringAndSize("", 0);
-    pagerhist_ensure_start_is_valid_utf8(ph);
+    pagerhist_convert_pending(ph);
+    if (!ph || !ph->bytes_used) return PyBytes_FromStringAndSize("", 0);
     if (ph->rewrap_needed) pagerhist_rewrap_to(self, self->xnum);
 
-    size_t sz = ringbuf_bytes_used(ph->ringbuf);
+    size_t sz = ph->bytes_used;
     PyObject *ans = PyBytes_FromStringAndSize(NULL, sz);
     if (!ans) return NULL;
     uint8_t *buf = (uint8_t*)PyBytes_AS_STRING(ans);
-    ringbuf_memcpy_from(buf, ph->ringbuf, sz);
+    const uint8_t *data;
+    for (size_t i = 0, n, pos = 0; (n = pagerhist_span(ph, i, &data)); i++, pos += n) memcpy(buf + pos, data, n);
     if (upto_output_start) {
         const uint8_t *p = reverse_find(buf, sz, (const uint8_t*)"\x1b]133;C\x1b\\");
         if (p) {
@@ -513,11 +1793,32 @@ as_text_history_buf(HistoryBuf *self, PyObject *args, ANSIBuf *output) {
     return ans;
 }
 
+bool
+historybuf_write_for_pager(HistoryBuf *self, PagerWriter *w, ANSIBuf *as_ansi_buf) {
+    // Write the same text as pagerhist_as_bytes() followed by as_text_history_buf()
+    // returns false if there was nothing to write
+    PagerHistoryBuf *ph = self->pagerhist;
+    bool has_pagerhist = false;
+    pagerhist_convert_pending(ph);
+    if (ph && ph->bytes_used) {
+        if (ph->rewrap_needed) pagerhist_rewrap_to(self, self->xnum);
+        ph = self->pagerhist;
+        const uint8_t *data;
+        for (size_t i = 0, n; (n = pagerhist_span(ph, i, &data)); i++) pager_writer_write(w, data, n);
+        has_pagerhist = ph->bytes_used > 0;
+    }
+    if (!self->count) return has_pagerhist;
+    GetLineWrapper glw = {.self=self};
+    glw.line.xnum = self->xnum;
+    write_lines_for_pager(w, &glw, get_line_wrapper, self->count, as_ansi_buf, true);
+    return true;
+}
 
 static PyObject*
 dirty_lines(HistoryBuf *self, PyObject *a UNUSED) {
 #define dirty_lines_doc "dirty_lines() -> Line numbers of all lines that have dirty text."
     PyObject *ans = PyList_New(0);
+    rewrap_pending_lines(self);
     for (index_type i = 0; i < self->count; i++) {
         if (attrptr(self, i)->has_dirty_text) {
             PyList_Append(ans, PyLong_FromUnsignedLong(i));
@@ -526,6 +1827,42 @@ dirty_lines(HistoryBuf *self, PyObject *a UNUSED) {
     return ans;
 }
 
+static PyObject*
+compression_stats(HistoryBuf *self, PyObject *a UNUSED) {
+#define compression_stats_doc "compression_stats() -> Statistics about the compression and spilling to disk of cold segments of this buffer, sizes are in bytes"
+    const size_t segment_sz = segment_cells_size(self);
+    return Py_BuildValue("{sI sI sn sn sn sI sn sn}",
+        "segments", self->num_segments, "compressed_segments", (unsigned int)self->compressed.segments,
+        "compressed_size", (Py_ssize_t)self->compressed.bytes,
+        "uncompressed_size", (Py_ssize_t)(self->compressed.segments * segment_sz),
+        "saved", (Py_ssize_t)(self->compressed.segments * segment_sz - self->compressed.bytes),
+        "spilled_segments", (unsigned int)self->spill.segments,
+        "spilled_size", (Py_ssize_t)self->spill.bytes,
+        "memory_used", (Py_ssize_t)segments_memory(self)
+    );
+}
+
+static PyObject*
+compress_cold_segments(HistoryBuf *self, PyObject *a UNUSED) {
+#define compress_cold_segments_doc "compress_cold_segments() -> Compress the segments that are no longer hot, as is done when the child is idle, waiting for it to finish"
+    compress_cold(self, true);
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+search(HistoryBuf *self, PyObject *args) {
+#define search_doc "search(query, lnum=0, backwards=True) -> (lnum, start_x, end_x) of the first match of query at or after the line lnum or None"
+    PyObject *query; unsigned int lnum = 0; int backwards = 1;
+    if (!PyArg_ParseTuple(args, "U|Ip", &query, &lnum, &backwards)) return NULL;
+    Py_UCS4 *q = PyUnicode_AsUCS4Copy(query);
+    if (!q) return NULL;
+    HistorySearchResult r;
+    bool found = historybuf_search(self, q, PyUnicode_GET_LENGTH(query), lnum, backwards, &r);
+    PyMem_Free(q);
+    if (!found) Py_RETURN_NONE;
+    return Py_BuildValue("III", r.lnum, r.start_x, r.end_x);
+}
+
 static PyObject*
 pagerhist_rewrap(HistoryBuf *self, PyObject *xnum) {
     if (self->pagerhist) {
@@ -547,11 +1884,21 @@ static PyMethodDef methods[] = {
     METHODB(pagerhist_as_text, METH_VARARGS),
     METHODB(pagerhist_as_bytes, METH_VARARGS),
     METHOD(dirty_lines, METH_NOARGS)
+    METHOD(compression_stats, METH_NOARGS)
+    METHOD(compress_cold_segments, METH_NOARGS)
+    METHOD(search, METH_VARARGS)
     METHOD(push, METH_VARARGS)
     METHOD(rewrap, METH_VARARGS)
     {NULL, NULL, 0, NULL}  /* Sentinel */
 };
 
+static PyObject* test_rewrap_ranges(PyObject *self, PyObject *num);
+
+static PyMethodDef module_methods[] = {
+    METHODB(test_rewrap_ranges, METH_O),
+    {NULL, NULL, 0, NULL}  /* Sentinel */
+};
+
 static PyMemberDef members[] = {
     {"xnum", T_UINT, offsetof(HistoryBuf, xnum), READONLY, "xnum"},
     {"ynum", T_UINT, offsetof(HistoryBuf, ynum), READONLY, "ynum"},
@@ -574,8 +1921,8 @@ PyTypeObject HistoryBuf_Type = {
 
 INIT_TYPE(HistoryBuf)
 
-HistoryBuf *alloc_historybuf(unsigned int lines, unsigned int columns, unsigned int pagerhist_sz) {
-    return create_historybuf(&HistoryBuf_Type, columns, lines, pagerhist_sz);
+HistoryBuf *alloc_historybuf(unsigned int lines, unsigned int columns, unsigned int pagerhist_sz, unsigned int memory_limit) {
+    return create_historybuf(&HistoryBuf_Type, columns, lines, pagerhist_sz, memory_limit);
 }
 // }}}
 
@@ -585,40 +1932,318 @@ HistoryBuf *alloc_historybuf(unsigned int lines, unsigned int columns, unsigned
 
 #define init_src_line(src_y) init_line(src, map_src_index(src_y), src->line);
 
-#define next_dest_line(cont) { history_buf_set_last_char_as_continuation(dest, 0, cont); LineAttrs *lap = attrptr(dest, historybuf_push(dest, as_ansi_buf)); *lap = src->line->attrs; }
+#define push_dest_line { \
+    const bool reuses_line = dest->count == dest->ynum; \
+    LineAttrs *lap = attrptr(dest, historybuf_push(dest, as_ansi_buf)); *lap = src->line->attrs; \
+    if (reuses_line) { \
+        memset(dest->line->cpu_cells, 0, dest->xnum * sizeof(CPUCell)); memset(dest->line->gpu_cells, 0, dest->xnum * sizeof(GPUCell)); \
+    } \
+}
+
+#define next_dest_line(cont) { history_buf_set_last_char_as_continuation(dest, 0, cont); set_line_length(dest, index_of(dest, 0), dest_x); push_dest_line }
+
+#define first_dest_line { history_buf_set_last_char_as_continuation(dest, 0, false); push_dest_line }
 
-#define first_dest_line next_dest_line(false);
+#define finish_last_dest_line set_line_length(dest, index_of(dest, 0), dest_x)
 
 #include "rewrap.h"
 
+// Parallel rewrapping {{{
+// Logical lines are rewrapped independently of each other, so the rewrapped
+// lines are split into ranges of whole segments, each of which is filled by
+// its own thread in a private buffer, whose segments are then moved into
+// place. The line lengths give where in the source each range starts.
+
+#define MAX_REWRAP_THREADS 8
+#define MIN_SEGMENTS_PER_REWRAP_THREAD 4
+// when not zero the number of ranges, whatever the number of CPUs
+static index_type rewrap_ranges_for_tests = 0;
+
+typedef struct {
+    HistoryBuf *buf;
+    index_type seg_num;
+    CPUCell *cpu_cells;
+    GPUCell *gpu_cells;
+    uint8_t *decoded;
+} SegmentReader;
+
+static void
+read_line(SegmentReader *r, index_type y, Line *l) {
+    // Unlike init_line() this does not change the buffer, so any number of threads can read it at once
+    HistoryBuf *self = r->buf;
+    const index_type idx = (self->start_of_data + y) % self->ynum, seg_num = idx / SEGMENT_SIZE;
+    HistoryBufSegment *s = self->segments + seg_num;
+    if (seg_num != r->seg_num || !r->cpu_cells) {
+        r->seg_num = seg_num;
+        if (s->cpu_cells && !s->compressed_cells) { r->cpu_cells = s->cpu_cells; r->gpu_cells = s->gpu_cells; }
+        else {
+            if (!r->decoded && !(r->decoded = malloc(segment_cells_size(self)))) fatal("Out of memory rewrapping history buffer");
+            r->cpu_cells = (CPUCell*)r->decoded; r->gpu_cells = (GPUCell*)(r->cpu_cells + self->xnum * SEGMENT_SIZE);
+            const uint8_t *data = s->spilled ? map_spilled_segment(self, s) : s->compressed_cells, *p = data;
+            index_type i = 0;
+            if (!data) {
+                // the lines are lost, they are rewrapped as blank lines
+                memset(r->decoded, 0, segment_cells_size(self));
+                i = SEGMENT_SIZE;
+            }
+            if (is_overwriting(s)) {
+                // the lines already overwritten are in the cells, the others are still compressed
+                memcpy(r->cpu_cells, s->cpu_cells, s->overwritten * self->xnum * sizeof(CPUCell));
+                memcpy(r->gpu_cells, s->gpu_cells, s->overwritten * self->xnum * sizeof(GPUCell));
+                i = s->overwritten; p += s->compressed_pos;
+            }
+            for (; i < SEGMENT_SIZE; i++) p = decode_line(p, r->cpu_cells + i * self->xnum, r->gpu_cells + i * self->xnum, self->xnum);
+            if (s->spilled && data) munmap((void*)data, s->compressed_cells_sz);
+        }
+    }
+    const index_type i = idx % SEGMENT_SIZE;
+    l->cpu_cells = r->cpu_cells + i * self->xnum; l->gpu_cells = r->gpu_cells + i * self->xnum;
+    l->attrs = s->line_attrs[i];
+}
+
+typedef struct {
+    HistoryBuf *src, *dest;
+    // The range starts at line first_line of the rewrapped logical line
+    // starting at the line src_y of src, less its first skip cells
+    index_type src_y, first_line, num_lines;
+    size_t skip;
+    bool is_last;
+    Line line;
+    pthread_t thread;
+    bool thread_started;
+} RewrapRange;
+
+static void*
+rewrap_range(void *data) {
+    RewrapRange *r = data;
+    HistoryBuf *src = r->src, *dest = r->dest;
+    SegmentReader reader = {.buf=src};
+    Line sl = {.xnum=src->xnum};
+    index_type y = r->src_y, k = r->first_line, done = 0;
+    for (size_t skip = r->skip; done < r->num_lines && y < src->count; skip = 0, k = 0) {
+        const index_type first = y;
+        const size_t len = logical_line_length(src, &y, src->count);
+        for (const index_type n = lines_for_cells(len - skip, dest->xnum); k < n && done < r->num_lines; k++, done++) {
+            const size_t start = skip + (size_t)k * dest->xnum, end = MIN(len, start + dest->xnum);
+            const index_type idx = historybuf_push(dest, NULL);
+            LineAttrs *attrs = attrptr(dest, idx);
+            // the attributes of the line with the first cell, as in rewrap_inner()
+            read_line(&reader, first + MIN(start / src->xnum, y - first - 1), &sl);
+            *attrs = sl.attrs;
+            attrs->has_dirty_text = true;
+            for (size_t c = start; c < end; ) {
+                const index_type src_x = c % src->xnum, num = MIN(src->xnum - src_x, end - c);
+                read_line(&reader, first + c / src->xnum, &sl);
+                copy_range(&sl, src_x, dest->line, c - start, num);
+                if (src_x + num == src->xnum) dest->line->gpu_cells[c - start + num - 1].attrs.next_char_was_wrapped = false;
+                c += num;
+            }
+            dest->line->gpu_cells[dest->xnum - 1].attrs.next_char_was_wrapped = end < len;
+            set_line_length(dest, idx, end - start);
+            // the lines are indexed as they are rewrapped, dest having fresh segments
+            HistoryBufSegment *s = dest->segments + idx / SEGMENT_SIZE;
+            index_line_text(s->search_index, idx % SEGMENT_SIZE, dest->search_text, searchable_text(dest->line->cpu_cells, dest->line->gpu_cells, dest->xnum, dest->search_text, NULL));
+            s->indexed_lines = idx % SEGMENT_SIZE + 1;
+        }
+    }
+    if (!r->is_last) {
+        // the segments of the later ranges are the hot ones
+        for (index_type i = 0; i < dest->num_hot_segments; i++) compress_segment(dest, dest->segments + dest->hot_segments[i]);
+        dest->num_hot_segments = 0;
+    }
+    free(reader.decoded);
+    return NULL;
+}
+
+static void
+rewrap_lines(HistoryBuf *src, size_t skip, HistoryBuf *dest, index_type num_lines) {
+    // Rewrap the lines of src, less the first skip cells of its text, into dest,
+    // replacing its contents. num_lines is the number of lines this produces,
+    // which must be no more than dest->ynum.
+    clear_segments(dest);
+    const index_type num_segments = (num_lines + SEGMENT_SIZE - 1) / SEGMENT_SIZE;
+    static long num_cpus = 0;
+    if (!num_cpus) num_cpus = MAX(1, sysconf(_SC_NPROCESSORS_ONLN));
+    index_type num_ranges = MAX(1u, MIN(num_segments / MIN_SEGMENTS_PER_REWRAP_THREAD, (index_type)MIN(num_cpus, MAX_REWRAP_THREADS)));
+    if (rewrap_ranges_for_tests) num_ranges = MAX(1u, MIN(num_segments, rewrap_ranges_for_tests));
+    const index_type segments_per_range = (num_segments + num_ranges - 1) / num_ranges, lines_per_range = segments_per_range * SEGMENT_SIZE;
+    num_ranges = (num_segments + segments_per_range - 1) / segments_per_range;
+    RewrapRange ranges[MAX_REWRAP_THREADS] = {{0}};
+    index_type y = 0, line = 0, n = 0, group_start = 0;
+    size_t group_skip = skip;
+    for (index_type i = 0; i < num_ranges; i++) {
+        RewrapRange *r = ranges + i;
+        const index_type target = i * lines_per_range;
+        // find the logical line with the rewrapped line number target
+        while (line + n <= target) {
+            line += n; group_start = y; group_skip = y ? 0 : skip;
+            n = lines_for_cells(logical_line_length(src, &y, src->count) - group_skip, dest->xnum);
+        }
+        *r = (RewrapRange){
+            .src=src, .src_y=group_start, .first_line=target - line, .skip=group_skip,
+            .num_lines=MIN(lines_per_range, num_lines - target), .is_last=i + 1 == num_ranges, .line={.xnum=dest->xnum},
+        };
+        if (i) {
+            if (!(r->dest = calloc(1, sizeof(HistoryBuf)))) fatal("Out of memory rewrapping history buffer");
+            *r->dest = (HistoryBuf){.xnum=dest->xnum, .ynum=lines_per_range, .line=&r->line, .spill={.fd=-1}};
+            if (!(r->dest->search_text = malloc(dest->xnum * sizeof(char_type)))) fatal("Out of memory rewrapping history buffer");
+            add_segment(r->dest);
+            int ret = pthread_create(&r->thread, NULL, rewrap_range, r);
+            if (ret == 0) r->thread_started = true;
+            else log_error("Failed to start rewrap thread with error: %s", strerror(ret));
+        } else r->dest = dest;
+    }
+    rewrap_range(ranges);
+    for (index_type i = 1; i < num_ranges; i++) {
+        RewrapRange *r = ranges + i;
+        if (r->thread_started) pthread_join(r->thread, NULL);
+        else rewrap_range(r);
+        // move the segments into dest
+        HistoryBuf *t = r->dest;
+        const index_type base = dest->num_segments;
+        dest->segments = realloc(dest->segments, sizeof(HistoryBufSegment) * (base + t->num_segments));
+        if (!dest->segments) fatal("Out of memory rewrapping history buffer");
+        memcpy(dest->segments + base, t->segments, sizeof(HistoryBufSegment) * t->num_segments);
+        dest->num_segments += t->num_segments;
+        dest->compressed.segments += t->compressed.segments; dest->compressed.bytes += t->compressed.bytes;
+        dest->compressed.in_progress += t->compressed.in_progress; dest->compressed.has_cold |= t->compressed.has_cold;
+        dest->count += t->count;
+        dest->num_hot_segments = t->num_hot_segments;
+        for (index_type h = 0; h < t->num_hot_segments; h++) dest->hot_segments[h] = base + t->hot_segments[h];
+        free(t->segments); free(t->search_text); free(t);
+    }
+    if (num_ranges > 1) for (index_type i = 0; i < dest->num_segments; i++) enforce_memory_limit(dest, dest->segments + i);
+}
+
+static PyObject*
+test_rewrap_ranges(PyObject UNUSED *self, PyObject *num) {
+    if (!PyLong_Check(num)) { PyErr_SetString(PyExc_TypeError, "An integer is required"); return NULL; }
+    rewrap_ranges_for_tests = MIN(PyLong_AsUnsignedLong(num), (unsigned long)MAX_REWRAP_THREADS);
+    Py_RETURN_NONE;
+}
+// }}}
+
+static void
+rewrap_pending_lines(HistoryBuf *self) {
+    if (!self->reflow.num_lines) return;
+    Line dest_line = {.xnum=self->xnum}, l = {.xnum=self->xnum};
+    HistoryBuf dest = {
+        .xnum=self->xnum, .ynum=self->ynum, .line=&dest_line, .search_text=self->search_text,
+        .spill={.fd=-1, .memory_limit=self->spill.memory_limit}
+    };
+    rewrap_lines(self->reflow.src, self->reflow.skip, &dest, self->reflow.num_lines);
+    // followed by the lines added since the resize
+    for (index_type i = 0, own = self->count - self->reflow.num_lines; i < own; i++) {
+        init_line(self, (self->start_of_data + i) % self->ynum, &l);
+        historybuf_add_line(&dest, &l, NULL);
+    }
+    swap_storage(self, &dest);
+    free_storage(&dest);
+}
+
+static void
+copy_segment(HistoryBuf *self, HistoryBuf *other, index_type i) {
+    // Copies the segment keeping it compressed if it is compressed
+    HistoryBufSegment *src = self->segments + i, *dest = other->segments + i;
+    if (is_overwriting(src)) finish_overwriting(self, src);
+    if (dest->compression) finish_compression(other, dest, false);
+    if (is_overwriting(dest)) stop_overwriting(dest);
+    const uint8_t *spilled_data = NULL;
+    if (src->spilled && !(spilled_data = map_spilled_segment(self, src))) lose_spilled_segment(self, src);
+    memcpy(dest->line_attrs, src->line_attrs, SEGMENT_SIZE * sizeof(LineAttrs));
+    memcpy(dest->line_lengths, src->line_lengths, SEGMENT_SIZE * sizeof(src->line_lengths[0]));
+    if (dest->compressed_cells) {
+        other->compressed.segments--; other->compressed.bytes -= dest->compressed_cells_sz;
+        free(dest->compressed_cells); dest->compressed_cells = NULL; dest->compressed_cells_sz = 0;
+    }
+    if (dest->spilled) {
+        other->spill.segments--; other->spill.bytes -= dest->compressed_cells_sz;
+        dest->spilled = false; dest->compressed_cells_sz = 0;
+    }
+    if (src->compressed_cells || src->spilled) {
+        free_segment_cells(other, dest, true);
+        dest->compressed_cells = malloc(src->compressed_cells_sz);
+        if (!dest->compressed_cells) fatal("Out of memory copying history buffer segment");
+        const uint8_t *data = src->spilled ? spilled_data : src->compressed_cells;
+        memcpy(dest->compressed_cells, data, src->compressed_cells_sz);
+        if (src->spilled) munmap((void*)data, src->compressed_cells_sz);
+        dest->compressed_cells_sz = src->compressed_cells_sz;
+        other->compressed.segments++; other->compressed.bytes += dest->compressed_cells_sz;
+        enforce_memory_limit(other, dest);
+    } else {
+        if (!dest->cpu_cells) alloc_segment_cells(other, dest, false);
+        memcpy(dest->cpu_cells, src->cpu_cells, segment_cells_size(self));
+    }
+    memcpy(dest->search_index, src->search_index, SEARCH_INDEX_BUCKETS * sizeof(src->search_index[0]));
+    dest->indexed_lines = src->indexed_lines; dest->old_indexed_lines = src->old_indexed_lines;
+}
+
 void
 historybuf_rewrap(HistoryBuf *self, HistoryBuf *other, ANSIBuf *as_ansi_buf) {
-    while(other->num_segments < self->num_segments) add_segment(other);
+    rewrap_pending_lines(self);
     if (other->xnum == self->xnum && other->ynum == self->ynum) {
         // Fast path
-        for (index_type i = 0; i < self->num_segments; i++) {
-            memcpy(other->segments[i].cpu_cells, self->segments[i].cpu_cells, SEGMENT_SIZE * self->xnum * sizeof(CPUCell));
-            memcpy(other->segments[i].gpu_cells, self->segments[i].gpu_cells, SEGMENT_SIZE * self->xnum * sizeof(GPUCell));
-            memcpy(other->segments[i].line_attrs, self->segments[i].line_attrs, SEGMENT_SIZE * sizeof(LineAttrs));
-        }
+        while(other->num_segments < self->num_segments) add_segment(other);
+        for (index_type i = 0; i < self->num_segments; i++) copy_segment(self, other, i);
+        other->num_hot_segments = 0;
+        other->compressed.has_cold = true;
         other->count = self->count; other->start_of_data = self->start_of_data;
         return;
     }
-    if (other->pagerhist && other->xnum != self->xnum && ringbuf_bytes_used(other->pagerhist->ringbuf))
+    if (other->pagerhist && other->xnum != self->xnum && (other->pagerhist->bytes_used || other->pagerhist->pending.num_lines || other->pagerhist->num_converting))
         other->pagerhist->rewrap_needed = true;
     other->count = 0; other->start_of_data = 0;
     if (self->count > 0) {
+        const size_t num_lines = rewrapped_line_count(self, self->count, 0, other->xnum);
+        if (num_lines <= other->ynum) rewrap_lines(self, 0, other, num_lines);
+        else {
+            // the lines that do not fit have to be removed, and written to the pager history, in order
+            rewrap_inner(self, other, self->count, NULL, NULL, as_ansi_buf);
+            for (index_type i = 0; i < other->count; i++) attrptr(other, (other->start_of_data + i) % other->ynum)->has_dirty_text = true;
+        }
+    }
+}
+
+void
+historybuf_rewrap_lazily(HistoryBuf *self, HistoryBuf *other, ANSIBuf *as_ansi_buf) {
+    // Like historybuf_rewrap() except that the lines are moved rather than
+    // copied, leaving self empty, and are only rewrapped when first needed
+    if (!self->count) { historybuf_rewrap(self, other, as_ansi_buf); return; }
+    if (other->xnum == self->xnum && other->ynum == self->ynum) { swap_storage(self, other); return; }
+    // rewrapping the last line later must not depend on the lines that follow it
+    if (!self->reflow.num_lines) history_buf_set_last_char_as_continuation(self, 0, false);
+    // lines added to self since it was itself rewrapped lazily are rewrapped now
+    const index_type own = self->count - self->reflow.num_lines;
+    HistoryBuf *src = self->reflow.num_lines ? self->reflow.src : self;
+    size_t num_lines = rewrapped_line_count(src, src->count, self->reflow.skip, other->xnum);
+    if (other->pagerhist && num_lines + rewrapped_line_count(self, self->reflow.num_lines ? own : 0, 0, other->xnum) > other->ynum) {
+        // the lines that do not fit have to be written to the pager history
+        historybuf_rewrap(self, other, as_ansi_buf);
+        return;
+    }
+    if (other->pagerhist && other->xnum != self->xnum && (other->pagerhist->bytes_used || other->pagerhist->pending.num_lines || other->pagerhist->num_converting))
+        other->pagerhist->rewrap_needed = true;
+    other->count = 0; other->start_of_data = 0;
+    if (self->reflow.num_lines) {
+        other->reflow = self->reflow;
+        memset(&self->reflow, 0, sizeof(self->reflow));
+        self->count = own;
+    } else other->reflow.src = detach_storage(self);
+    for (; num_lines > other->ynum; num_lines--) skip_oldest_pending_line(other);
+    other->count = other->reflow.num_lines = num_lines;
+    if (self->count) {
         rewrap_inner(self, other, self->count, NULL, NULL, as_ansi_buf);
-        for (index_type i = 0; i < other->count; i++) attrptr(other, (other->start_of_data + i) % other->ynum)->has_dirty_text = true;
+        for (index_type i = 0; i < other->count - other->reflow.num_lines; i++) attrptr(other, (other->start_of_data + i) % other->ynum)->has_dirty_text = true;
     }
 }
 
 static PyObject*
 rewrap(HistoryBuf *self, PyObject *args) {
-    HistoryBuf *other;
-    if (!PyArg_ParseTuple(args, "O!", &HistoryBuf_Type, &other)) return NULL;
+    HistoryBuf *other; int lazily = 0;
+    if (!PyArg_ParseTuple(args, "O!|p", &HistoryBuf_Type, &other, &lazily)) return NULL;
     ANSIBuf as_ansi_buf = {0};
-    historybuf_rewrap(self, other, &as_ansi_buf);
+    if (lazily) historybuf_rewrap_lazily(self, other, &as_ansi_buf);
+    else historybuf_rewrap(self, other, &as_ansi_buf);
     free(as_ansi_buf.buf);
     Py_RETURN_NONE;
 }
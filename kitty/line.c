@@ -725,7 +725,7 @@ decoration_as_sgr(uint8_t decoration) {
 
 const char*
 cell_as_sgr(const GPUCell *cell, const GPUCell *prev) {
-    static char buf[128];
+    static _Thread_local char buf[128];
 #define SZ sizeof(buf) - (p - buf) - 2
 #define P(s) { size_t len = strlen(s); if (SZ > len) { memcpy(p, s, len); p += len; } }
     char *p = buf;
@@ -898,6 +898,88 @@ as_text_generic(PyObject *args, void *container, get_line_func get_line, index_t
 #undef APPEND_AND_DECREF
 }
 
+// Writing lines for the pager {{{
+// Writes the same text as as_text_generic() with as_ansi and
+// insert_wrap_markers, encoded as UTF-8 directly to a file descriptor in
+// chunks, turning the wrap markers into newlines, as Window.pipe_data() does,
+// so that every line on screen is a line in the pager.
+
+#define PAGER_WRITER_BUF_SZ (64u * 1024u)
+
+bool
+pager_writer_flush(PagerWriter *w) {
+    for (size_t pos = 0; pos < w->len && !w->failed; ) {
+        ssize_t n = write(w->fd, w->buf + pos, w->len - pos);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            w->failed = true;
+        } else if (n == 0) w->failed = true;
+        else pos += n;
+    }
+    w->len = 0;
+    return !w->failed;
+}
+
+static void
+pager_writer_put(PagerWriter *w, uint8_t ch) {
+    if (ch == '\r') { ch = '\n'; w->after_cr = true; }
+    else {
+        const bool after_cr = w->after_cr;
+        w->after_cr = false;
+        if (ch == '\n' && after_cr) return;
+    }
+    if (ch == '\n') w->num_lines++;
+    if (UNLIKELY(w->len >= PAGER_WRITER_BUF_SZ)) pager_writer_flush(w);
+    w->buf[w->len++] = ch;
+}
+
+void
+pager_writer_write(PagerWriter *w, const uint8_t *data, size_t sz) {
+    if (!w->buf && !(w->buf = malloc(PAGER_WRITER_BUF_SZ))) { w->failed = true; errno = ENOMEM; }
+    if (w->failed) return;
+    for (size_t i = 0; i < sz; i++) pager_writer_put(w, data[i]);
+}
+
+static void
+pager_writer_write_ucs4(PagerWriter *w, const Py_UCS4 *text, size_t sz) {
+    char scratch[8];
+    pager_writer_write(w, NULL, 0);
+    if (w->failed) return;
+    for (size_t i = 0; i < sz; i++) {
+        if (text[i] < 0x80) pager_writer_put(w, text[i]);
+        else {
+            const unsigned n = encode_utf8(text[i], scratch);
+            for (unsigned k = 0; k < n; k++) pager_writer_put(w, scratch[k]);
+        }
+    }
+}
+
+void
+write_lines_for_pager(PagerWriter *w, void *container, get_line_func get_line, index_type lines, ANSIBuf *ansibuf, bool add_trailing_newline) {
+#define W(x) pager_writer_write(w, (const uint8_t*)x, sizeof(x) - 1)
+    const GPUCell *prev_cell = NULL;
+    ansibuf->active_hyperlink_id = 0;
+    bool need_newline = false;
+    for (index_type y = 0; y < lines && !w->failed; y++) {
+        Line *line = get_line(container, y);
+        if (!line) break;
+        if (need_newline) W("\n");
+        prev_cell = NULL;  // see the comment about less in as_text_generic()
+        line_as_ansi(line, ansibuf, &prev_cell, 0, line->xnum, 0);
+        if (ansibuf->len > 0) W("\x1b[m");
+        pager_writer_write_ucs4(w, ansibuf->buf, ansibuf->len);
+        W("\r");
+        need_newline = !line->gpu_cells[line->xnum-1].attrs.next_char_was_wrapped;
+    }
+    if (need_newline && add_trailing_newline) W("\n");
+    if (ansibuf->active_hyperlink_id) {
+        ansibuf->active_hyperlink_id = 0;
+        W("\x1b]8;;\x1b\\");
+    }
+#undef W
+}
+// }}}
+
 // Boilerplate {{{
 static PyObject*
 copy_char(Line* self, PyObject *args);
@@ -82,6 +82,12 @@ line_is_empty(const Line *line) {
 }
 
 typedef Line*(get_line_func)(void *, int);
+typedef struct PagerWriter {
+    int fd;
+    uint8_t *buf;
+    size_t len, num_lines;
+    bool after_cr, failed;
+} PagerWriter;
 void line_clear_text(Line *self, unsigned int at, unsigned int num, char_type ch);
 void line_apply_cursor(Line *self, Cursor *cursor, unsigned int at, unsigned int num, bool clear_char);
 char_type line_get_char(Line *self, index_type at);
@@ -120,6 +126,7 @@ void linebuf_refresh_sprite_positions(LineBuf *self);
 void historybuf_add_line(HistoryBuf *self, const Line *line, ANSIBuf*);
 bool historybuf_pop_line(HistoryBuf *, Line *);
 void historybuf_rewrap(HistoryBuf *self, HistoryBuf *other, ANSIBuf*);
+void historybuf_rewrap_lazily(HistoryBuf *self, HistoryBuf *other, ANSIBuf*);
 void historybuf_init_line(HistoryBuf *self, index_type num, Line *l);
 bool history_buf_endswith_wrap(HistoryBuf *self);
 CPUCell* historybuf_cpu_cells(HistoryBuf *self, index_type num);
@@ -128,7 +135,15 @@ void historybuf_mark_line_dirty(HistoryBuf *self, index_type y);
 void historybuf_set_line_has_image_placeholders(HistoryBuf *self, index_type y, bool val);
 void historybuf_refresh_sprite_positions(HistoryBuf *self);
 void historybuf_clear(HistoryBuf *self);
+typedef struct HistorySearchResult { index_type lnum, start_x, end_x; } HistorySearchResult;
+bool historybuf_write_for_pager(HistoryBuf *self, PagerWriter *w, ANSIBuf *as_ansi_buf);
+bool historybuf_convert_pending_pagerhist(HistoryBuf *self);
+bool historybuf_compress_cold_segments(HistoryBuf *self);
+bool historybuf_search(HistoryBuf *self, const char_type *query, index_type query_len, index_type lnum, bool backwards, HistorySearchResult *ans);
 void mark_text_in_line(PyObject *marker, Line *line);
 bool line_has_mark(Line *, uint16_t mark);
 PyObject* as_text_generic(PyObject *args, void *container, get_line_func get_line, index_type lines, ANSIBuf *ansibuf, bool add_trailing_newline);
+void pager_writer_write(PagerWriter *w, const uint8_t *data, size_t sz);
+bool pager_writer_flush(PagerWriter *w);
+void write_lines_for_pager(PagerWriter *w, void *container, get_line_func get_line, index_type lines, ANSIBuf *ansibuf, bool add_trailing_newline);
 bool colors_for_cell(Line *self, ColorProfile *cp, index_type *x, color_type *fg, color_type *bg, bool *reversed);
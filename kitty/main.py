@@ -520,6 +520,10 @@ def _main() -> None:
         from kitty.client import main as client_main
         client_main(cli_opts.replay_commands)
         return
+    if cli_opts.replay_pty:
+        from kitty.pty_recording import main as replay_main
+        replay_main(cli_opts.replay_pty, cli_opts.replay_pty_speed)
+        return
     if cli_opts.single_instance:
         is_first = single_instance(cli_opts.instance_group)
         if not is_first:
@@ -366,11 +366,24 @@
 allocated on demand. Negative numbers are (effectively) infinite scrollback.
 Note that using very large scrollback is not recommended as it can slow down
 performance of the terminal and also use large amounts of RAM. Instead, consider
-using :opt:`scrollback_pager_history_size`. Note that on config reload if this
+using :opt:`scrollback_pager_history_size` or :opt:`scrollback_memory_limit`. Note that on config reload if this
 is changed it will only affect newly created windows, not existing ones.
 '''
     )
 
+opt('scrollback_memory_limit', '0',
+    option_type='scrollback_pager_history_size', ctype='uint',
+    long_text='''
+The maximum amount of memory (in MB) used by the scrollback of each window.
+Once the scrollback uses more than this, older scrollback is moved to a
+temporary file in the cache directory, which makes it possible to use very large
+values of :opt:`scrollback_lines` with bounded memory usage. Scrollback on disk
+is read back transparently when scrolled to. A value of zero disables this
+feature. Note that on config reload if this is changed it will only affect newly
+created windows, not existing ones.
+'''
+    )
+
 opt('scrollback_pager', 'less --chop-long-lines --RAW-CONTROL-CHARS +INPUT_LINE_NUMBER',
     option_type='to_cmdline',
     long_text='''
@@ -864,7 +877,12 @@
 milliseconds). Note that decreasing it will increase responsiveness, but also
 increase CPU usage and might cause flicker in full screen programs that redraw
 the entire screen on each loop, because kitty is so fast that partial screen
-updates will be drawn.
+updates will be drawn. The actual delay adapts to the rate at which each
+program produces output, small interactive bursts, such as the echo of typed
+characters, are processed immediately, while large amounts of output are
+processed in batches with a delay of up to twice this value, but no more than
+:opt:`repaint_delay`. Run kitty with :option:`kitty --debug-rendering` to see
+the delay chosen for each window.
 '''
     )
 
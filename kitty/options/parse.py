@@ -1175,6 +1175,9 @@ def scrollback_fill_enlarged_window(self, val: str, ans: typing.Dict[str, typing
     def scrollback_lines(self, val: str, ans: typing.Dict[str, typing.Any]) -> None:
         ans['scrollback_lines'] = scrollback_lines(val)
 
+    def scrollback_memory_limit(self, val: str, ans: typing.Dict[str, typing.Any]) -> None:
+        ans['scrollback_memory_limit'] = scrollback_pager_history_size(val)
+
     def scrollback_pager(self, val: str, ans: typing.Dict[str, typing.Any]) -> None:
         ans['scrollback_pager'] = to_cmdline(val)
 
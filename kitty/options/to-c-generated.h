@@ -135,6 +135,19 @@ convert_from_opts_cursor_stop_blinking_after(PyObject *py_opts, Options *opts) {
     Py_DECREF(ret);
 }
 
+static void
+convert_from_python_scrollback_memory_limit(PyObject *val, Options *opts) {
+    opts->scrollback_memory_limit = PyLong_AsUnsignedLong(val);
+}
+
+static void
+convert_from_opts_scrollback_memory_limit(PyObject *py_opts, Options *opts) {
+    PyObject *ret = PyObject_GetAttrString(py_opts, "scrollback_memory_limit");
+    if (ret == NULL) return;
+    convert_from_python_scrollback_memory_limit(ret, opts);
+    Py_DECREF(ret);
+}
+
 static void
 convert_from_python_scrollback_pager_history_size(PyObject *val, Options *opts) {
     opts->scrollback_pager_history_size = PyLong_AsUnsignedLong(val);
@@ -1132,6 +1145,8 @@ convert_opts_from_python_opts(PyObject *py_opts, Options *opts) {
     if (PyErr_Occurred()) return false;
     convert_from_opts_cursor_stop_blinking_after(py_opts, opts);
     if (PyErr_Occurred()) return false;
+    convert_from_opts_scrollback_memory_limit(py_opts, opts);
+    if (PyErr_Occurred()) return false;
     convert_from_opts_scrollback_pager_history_size(py_opts, opts);
     if (PyErr_Occurred()) return false;
     convert_from_opts_scrollback_fill_enlarged_window(py_opts, opts);
@@ -402,6 +402,7 @@
  'resize_in_steps',
  'scrollback_fill_enlarged_window',
  'scrollback_lines',
+ 'scrollback_memory_limit',
  'scrollback_pager',
  'scrollback_pager_history_size',
  'select_by_word_characters',
@@ -561,6 +562,7 @@ class Options:
     resize_in_steps: bool = False
     scrollback_fill_enlarged_window: bool = False
     scrollback_lines: int = 2000
+    scrollback_memory_limit: int = 0
     scrollback_pager: typing.List[str] = ['less', '--chop-long-lines', '--RAW-CONTROL-CHARS', '+INPUT_LINE_NUMBER']
     scrollback_pager_history_size: int = 0
     select_by_word_characters: str = '@-./_~?&=%+#'
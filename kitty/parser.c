@@ -14,6 +14,7 @@
 #include "screen.h"
 #include "charsets.h"
 #include "monotonic.h"
+#include "simd-string.h"
 #include <time.h>
 
 extern PyTypeObject Screen_Type;
@@ -119,6 +120,9 @@ _report_params(PyObject *dump_callback, const char *name, int *params, unsigned
 #define REPORT_DRAW(ch) \
     Py_XDECREF(PyObject_CallFunction(dump_callback, "sC", "draw", ch)); PyErr_Clear();
 
+#define REPORT_DRAW_RUN(chars, num) \
+    Py_XDECREF(PyObject_CallFunction(dump_callback, "sN", "draw", PyUnicode_FromKindAndData(PyUnicode_4BYTE_KIND, chars, num))); PyErr_Clear();
+
 #define REPORT_PARAMS(name, params, num, region) _report_params(dump_callback, name, params, num_params, region)
 
 #define FLUSH_DRAW \
@@ -142,6 +146,7 @@ _report_params(PyObject *dump_callback, const char *name, int *params, unsigned
 #define REPORT_COMMAND(...)
 #define REPORT_VA_COMMAND(...)
 #define REPORT_DRAW(ch)
+#define REPORT_DRAW_RUN(chars, num)
 #define REPORT_PARAMS(...)
 #define FLUSH_DRAW
 #define REPORT_OSC(name, string)
@@ -203,7 +208,14 @@ dispatch_normal_mode_char(Screen *screen, uint32_t ch, PyObject DUMP_UNUSED *dum
             break;
     }
 #undef CALL_SCREEN_HANDLER
-} // }}}
+}
+
+static void
+dispatch_normal_mode_run(Screen *screen, const uint8_t *src UNUSED, size_t src_sz UNUSED, const char_type *chars, size_t num, PyObject DUMP_UNUSED *dump_callback) {
+    REPORT_DRAW_RUN(chars, num);
+    screen_draw_run(screen, chars, num);
+}
+// }}}
 
 // Esc mode {{{
 static void
@@ -507,7 +519,7 @@ screen_tabn(Screen *s, unsigned int count) { for (index_type i=0; i < MAX(1u, co
 static const char*
 repr_csi_params(int *params, unsigned int num_params) {
     if (!num_params) return "";
-    static char buf[256];
+    static _Thread_local char buf[256];
     unsigned int pos = 0, i = 0;
     while (pos < 200 && i++ < num_params && sizeof(buf) > pos + 1) {
         const char *fmt = i < num_params ? "%i, " : "%i";
@@ -686,7 +698,7 @@ parse_region(Region *r, uint32_t *buf, unsigned int num) {
 
 static const char*
 csi_letter(unsigned code) {
-    static char buf[8];
+    static _Thread_local char buf[8];
     if (33 <= code && code <= 126) snprintf(buf, sizeof(buf), "%c", code);
     else snprintf(buf, sizeof(buf), "0x%x", code);
     return buf;
@@ -773,7 +785,7 @@ dispatch_csi(Screen *screen, PyObject DUMP_UNUSED *dump_callback) {
     char start_modifier = 0, end_modifier = 0;
     uint32_t *buf = screen->parser_buf, code = screen->parser_buf[screen->parser_buf_pos];
     unsigned int num = screen->parser_buf_pos, start, i, num_params=0;
-    static int params[MAX_PARAMS] = {0}, p1, p2;
+    static _Thread_local int params[MAX_PARAMS] = {0}, p1, p2;
     bool private;
     if (buf[0] == '>' || buf[0] == '<' || buf[0] == '?' || buf[0] == '!' || buf[0] == '=') {
         start_modifier = (char)screen->parser_buf[0];
@@ -1344,10 +1356,22 @@ END_ALLOW_CASE_RANGE
 
 extern uint32_t *latin1_charset;
 
+// Text in the ground state is decoded in bulk and handed over as runs,
+// control characters, escape codes, invalid and partial UTF-8 sequences go
+// through the UTF-8 decoder one byte at a time
 #define decode_loop(dispatch, watch_for_pending) { \
     i = 0; \
     uint32_t prev = screen->utf8_state; \
+    char_type text_run[1024]; \
     while(i < (size_t)len) { \
+        if (!screen->parser_state && screen->utf8_state == UTF8_ACCEPT && !screen->use_latin1) { \
+            size_t num_chars, consumed; \
+            while ((consumed = utf8_decode_text_run(buf + i, len - i, text_run, arraysz(text_run), &num_chars))) { \
+                dispatch##_normal_mode_run(screen, buf + i, consumed, text_run, num_chars, dump_callback); \
+                i += consumed; \
+            } \
+            if (i >= (size_t)len) break; \
+        } \
         uint8_t ch = buf[i++]; \
         if (screen->use_latin1) { \
             dispatch_unicode_char(latin1_charset[ch], dispatch, watch_for_pending); \
@@ -1383,17 +1407,30 @@ FLUSH_DRAW;
 }
 
 static void
-write_pending_char(Screen *screen, uint32_t ch) {
-    if (screen->pending_mode.capacity < screen->pending_mode.used + 8) {
+ensure_pending_space(Screen *screen, size_t needed) {
+    while (screen->pending_mode.capacity < screen->pending_mode.used + needed) {
         if (screen->pending_mode.capacity) {
             screen->pending_mode.capacity += screen->pending_mode.capacity >= READ_BUF_SZ ? PENDING_BUF_INCREMENT : screen->pending_mode.capacity;
         } else screen->pending_mode.capacity = PENDING_BUF_INCREMENT;
         screen->pending_mode.buf = realloc(screen->pending_mode.buf, screen->pending_mode.capacity);
         if (!screen->pending_mode.buf) fatal("Out of memory");
     }
+}
+
+static void
+write_pending_char(Screen *screen, uint32_t ch) {
+    ensure_pending_space(screen, 8);
     screen->pending_mode.used += encode_utf8(ch, (char*)screen->pending_mode.buf + screen->pending_mode.used);
 }
 
+static void
+write_pending_bytes(Screen *screen, const uint8_t *chars, size_t num) {
+    // chars must be valid UTF-8
+    ensure_pending_space(screen, num);
+    memcpy(screen->pending_mode.buf + screen->pending_mode.used, chars, num);
+    screen->pending_mode.used += num;
+}
+
 static void
 pending_normal_mode_char(Screen *screen, uint32_t ch, PyObject *dump_callback UNUSED) {
     switch(ch) {
@@ -1404,6 +1441,11 @@ pending_normal_mode_char(Screen *screen, uint32_t ch, PyObject *dump_callback UN
     }
 }
 
+static void
+pending_normal_mode_run(Screen *screen, const uint8_t *src, size_t src_sz, const char_type *chars UNUSED, size_t num UNUSED, PyObject *dump_callback UNUSED) {
+    write_pending_bytes(screen, src, src_sz);
+}
+
 static void
 pending_esc_mode_char(Screen *screen, uint32_t ch, PyObject *dump_callback UNUSED) {
     if (screen->parser_buf_pos > 0) {
@@ -1533,8 +1575,9 @@ do_parse_bytes(Screen *screen, const uint8_t *read_buf, const size_t read_buf_sz
                 _parse_bytes(screen, screen->pending_mode.buf, screen->pending_mode.used, dump_callback);
                 screen->pending_mode.used = 0;
                 screen->pending_mode.activated_at = 0;  // ignore any pending starts in the pending bytes
-                if (screen->pending_mode.capacity > READ_BUF_SZ + PENDING_BUF_INCREMENT) {
-                    screen->pending_mode.capacity = READ_BUF_SZ;
+                if (screen->pending_mode.capacity > PENDING_BUF_INCREMENT) {
+                    // dont hold on to the memory used by a large pending update
+                    screen->pending_mode.capacity = PENDING_BUF_INCREMENT;
                     screen->pending_mode.buf = realloc(screen->pending_mode.buf, screen->pending_mode.capacity);
                     if (!screen->pending_mode.buf) fatal("Out of memory");
                 }
@@ -1593,15 +1636,97 @@ FNAME(parse_bytes)(PyObject UNUSED *self, PyObject *args) {
 }
 
 
+static void
+parse_read_buf(Screen *screen, const size_t head, PyObject *dump_callback DUMP_UNUSED, monotonic_t now) {
+    // Consume the data the I/O thread has published to the read_buf ring
+    // buffer up to head. The data wraps around at most once, so it is parsed
+    // in at most two pieces, releasing the space of the first piece to the
+    // I/O thread as soon as it has been parsed.
+    size_t tail = atomic_load_explicit(&screen->read_buf_tail, memory_order_relaxed);
+    // The I/O thread may replace read_buf whenever it is empty, so it must not be touched then
+    if (tail == head) { do_parse_bytes(screen, (const uint8_t*)"", 0, now, dump_callback); return; }
+    do {
+        const size_t pos = tail & (screen->read_buf_sz - 1), sz = MIN(head - tail, screen->read_buf_sz - pos);
+#ifdef DUMP_COMMANDS
+        if (sz) {
+            Py_XDECREF(PyObject_CallFunction(dump_callback, "sy#", "bytes", screen->read_buf + pos, sz)); PyErr_Clear();
+        }
+#endif
+        do_parse_bytes(screen, screen->read_buf + pos, sz, now, dump_callback);
+        tail += sz;
+        atomic_store_explicit(&screen->read_buf_tail, tail, memory_order_release);
+    } while (tail != head);
+}
+
 void
 FNAME(parse_worker)(Screen *screen, PyObject *dump_callback, monotonic_t now) {
-#ifdef DUMP_COMMANDS
-    if (screen->read_buf_sz) {
-        Py_XDECREF(PyObject_CallFunction(dump_callback, "sy#", "bytes", screen->read_buf, screen->read_buf_sz)); PyErr_Clear();
+    parse_read_buf(screen, atomic_load_explicit(&screen->read_buf_head, memory_order_acquire), dump_callback, now);
+}
+
+#ifndef DUMP_COMMANDS
+// Input made up of only text, the C0 controls that move the cursor and the
+// SGR and EL escape codes never calls into Python, so it can be parsed
+// without the GIL, on a worker thread. This is the common case for windows
+// streaming logs. Anything else, including a partial escape code, is parsed
+// on the main thread.
+#define MAX_PYTHON_FREE_CSI_LEN 64
+
+bool
+parse_worker_is_python_free(Screen *screen, size_t *head_out) {
+    if (screen->parser_state || screen->utf8_state != UTF8_ACCEPT || screen->use_latin1) return false;
+    if (screen->pending_mode.activated_at || screen->pending_mode.used) return false;
+    // drawing text calls on_activity_since_last_focus()
+    if (!screen->has_activity_since_last_focus && !screen->has_focus && screen->callbacks != Py_None) return false;
+    // scrolling or erasing cells with images can delete them
+    if (screen->main_grman->images || screen->alt_grman->images) return false;
+    const size_t head = atomic_load_explicit(&screen->read_buf_head, memory_order_acquire);
+    enum { NORMAL_TEXT, AFTER_C2, AFTER_ESC, IN_CSI } state = NORMAL_TEXT;
+    unsigned csi_len = 0;
+    for (size_t pos = atomic_load_explicit(&screen->read_buf_tail, memory_order_relaxed); pos != head;) {
+        const uint8_t *p = screen->read_buf + (pos & (screen->read_buf_sz - 1));
+        const size_t sz = MIN(head - pos, screen->read_buf_sz - (pos & (screen->read_buf_sz - 1)));
+        size_t i = 0;
+        while (i < sz) {
+            const uint8_t b = p[i];
+            switch (state) {
+                case NORMAL_TEXT:
+                    if (0x20 <= b && b < 0x7f) { i += find_printable_ascii_run(p + i, sz - i); continue; }
+                    switch (b) {
+                        case NUL: case BS: case HT: case LF: case VT: case FF: case CR: case DEL: break;
+                        case ESC: state = AFTER_ESC; break;
+                        case 0xc2: state = AFTER_C2; break;  // the lead byte of the C1 controls
+                        default: if (b < 0x80) return false;
+                    }
+                    break;
+                case AFTER_C2:
+                    if (0x80 <= b && b <= 0x9f) return false;
+                    state = NORMAL_TEXT;
+                    continue;
+                case AFTER_ESC:
+                    if (b != ESC_CSI) return false;
+                    state = IN_CSI; csi_len = 0;
+                    break;
+                case IN_CSI:
+                    if (('0' <= b && b <= '9') || b == ';' || b == ':') {
+                        if (++csi_len > MAX_PYTHON_FREE_CSI_LEN) return false;
+                    } else if (b == 'm' || b == 'K') state = NORMAL_TEXT;
+                    else return false;
+                    break;
+            }
+            i++;
+        }
+        pos += sz;
     }
-#endif
-    do_parse_bytes(screen, screen->read_buf, screen->read_buf_sz, now, dump_callback);
-    screen->read_buf_sz = 0;
+    *head_out = head;
+    return state == NORMAL_TEXT;
 }
+#undef MAX_PYTHON_FREE_CSI_LEN
+
+void
+parse_worker_until(Screen *screen, size_t head, monotonic_t now) {
+    // May be called without the GIL, only after parse_worker_is_python_free() returned head
+    parse_read_buf(screen, head, NULL, now);
+}
+#endif
 #undef FNAME
 // }}}
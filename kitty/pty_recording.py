@@ -0,0 +1,89 @@
+#!/usr/bin/env python
+# License: GPL v3 Copyright: 2024, Kovid Goyal <kovid at kovidgoyal.net>
+
+# Read and replay the recordings of the bytes received from child processes
+# made with kitty --record-pty. The file format is the magic bytes followed by
+# a sequence of chunks, one per read() from a child's pty, each of which is:
+#   varint(nanoseconds since previous chunk) varint(window id) varint(size) bytes
+# where varint is an unsigned LEB128 number.
+
+import mmap
+import sys
+from contextlib import suppress
+from time import monotonic, sleep
+from typing import IO, Iterator, List, NamedTuple, Tuple, Union
+
+MAGIC = b'KPTYREC\x01'
+Buffer = Union[bytes, memoryview, mmap.mmap]
+
+
+class Chunk(NamedTuple):
+    delay: int  # nanoseconds since the previous chunk, from any window
+    window_id: int
+    data: memoryview
+
+
+def read_varint(buf: Buffer, pos: int) -> Tuple[int, int]:
+    ans = shift = 0
+    while True:
+        b = buf[pos]
+        pos += 1
+        ans |= (b & 0x7f) << shift
+        if b < 0x80:
+            return ans, pos
+        shift += 7
+
+
+def iter_chunks(buf: Buffer) -> Iterator[Chunk]:
+    if buf[:len(MAGIC)] != MAGIC:
+        raise ValueError('Not a kitty PTY recording')
+    mv = memoryview(buf)
+    pos = len(MAGIC)
+    while pos < len(buf):
+        try:
+            delay, pos = read_varint(buf, pos)
+            window_id, pos = read_varint(buf, pos)
+            sz, pos = read_varint(buf, pos)
+        except IndexError:
+            break  # the recording was truncated, for example by a crash
+        yield Chunk(delay, window_id, mv[pos:pos + sz])
+        pos += sz
+
+
+def chunks_for_window(buf: Buffer, window_id: int = 0) -> List[Chunk]:
+    ' Return the chunks received by the specified window, or the first window that produced output if window_id is zero '
+    ans: List[Chunk] = []
+    pending_delay = 0
+    for c in iter_chunks(buf):
+        if not window_id:
+            window_id = c.window_id
+        if c.window_id == window_id:
+            ans.append(c._replace(delay=c.delay + pending_delay))
+            pending_delay = 0
+        else:
+            pending_delay += c.delay
+    return ans
+
+
+def replay(chunks: List[Chunk], output: IO[bytes], speed: float = 1) -> None:
+    ' Write the chunks to output with their original timing divided by speed, or as fast as possible if speed is zero '
+    deadline = monotonic()
+    for c in chunks:
+        if speed > 0:
+            deadline += c.delay / (speed * 1e9)
+            delay = deadline - monotonic()
+            if delay > 0:
+                sleep(delay)
+        output.write(c.data)
+        output.flush()
+
+
+def main(path: str, speed: float = 1) -> None:
+    from kittens.tui.operations import raw_mode
+    with open(path, 'rb') as f, mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as buf:
+        chunks = chunks_for_window(buf)
+        # The recorded bytes have already been through the line discipline of
+        # the original pty, so they must not be translated again
+        with raw_mode(sys.stdout.fileno()) if sys.stdout.isatty() else suppress():
+            replay(chunks, sys.stdout.buffer, speed)
+        del chunks
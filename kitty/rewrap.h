@@ -37,6 +37,10 @@
     set_dest_line_attrs(dest_y);
 #endif
 
+#ifndef finish_last_dest_line
+#define finish_last_dest_line
+#endif
+
 #ifndef is_src_line_continued
 #define is_src_line_continued() (src->line->gpu_cells[src->xnum-1].attrs.next_char_was_wrapped)
 #endif
@@ -92,5 +96,6 @@ rewrap_inner(BufType *src, BufType *dest, const index_type src_limit, HistoryBuf
         src_y++; src_x = 0;
         if (!src_line_is_continued && src_y < src_limit) { init_src_line(src_y); next_dest_line(false); dest_x = 0; }
     } while (src_y < src_limit);
+    finish_last_dest_line;
     dest->line->ynum = dest_y;
 }
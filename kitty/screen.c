@@ -79,7 +79,6 @@ init_overlay_line(Screen *self, index_type columns, bool keep_active) {
 static void deactivate_overlay_line(Screen *self);
 static void update_overlay_position(Screen *self);
 static void render_overlay_line(Screen *self, Line *line, FONTS_DATA_HANDLE fonts_data);
-static void update_overlay_line_data(Screen *self, uint8_t *data);
 
 #define RESET_CHARSETS \
         self->g0_charset = translation_table(0); \
@@ -106,10 +105,6 @@ new(PyTypeObject *type, PyObject *args, PyObject UNUSED *kwds) {
 
     self = (Screen *)type->tp_alloc(type, 0);
     if (self != NULL) {
-        if ((ret = pthread_mutex_init(&self->read_buf_lock, NULL)) != 0) {
-            Py_CLEAR(self); PyErr_Format(PyExc_RuntimeError, "Failed to create Screen read_buf_lock mutex: %s", strerror(ret));
-            return NULL;
-        }
         if ((ret = pthread_mutex_init(&self->write_buf_lock, NULL)) != 0) {
             Py_CLEAR(self); PyErr_Format(PyExc_RuntimeError, "Failed to create Screen write_buf_lock mutex: %s", strerror(ret));
             return NULL;
@@ -134,7 +129,7 @@ new(PyTypeObject *type, PyObject *args, PyObject UNUSED *kwds) {
         self->color_profile = alloc_color_profile();
         self->main_linebuf = alloc_linebuf(lines, columns); self->alt_linebuf = alloc_linebuf(lines, columns);
         self->linebuf = self->main_linebuf;
-        self->historybuf = alloc_historybuf(MAX(scrollback, lines), columns, OPT(scrollback_pager_history_size));
+        self->historybuf = alloc_historybuf(MAX(scrollback, lines), columns, OPT(scrollback_pager_history_size), OPT(scrollback_memory_limit));
         self->main_grman = grman_alloc();
         self->alt_grman = grman_alloc();
         self->active_hyperlink_id = 0;
@@ -220,15 +215,17 @@ screen_dirty_sprite_positions(Screen *self) {
         linebuf_mark_line_dirty(self->main_linebuf, i);
         linebuf_mark_line_dirty(self->alt_linebuf, i);
     }
-    for (index_type i = 0; i < self->historybuf->count; i++) historybuf_mark_line_dirty(self->historybuf, i);
+    // lines still waiting to be rewrapped are marked dirty when they are rewrapped
+    const index_type stored = self->historybuf->count - self->historybuf->reflow.num_lines;
+    for (index_type i = 0; i < stored; i++) historybuf_mark_line_dirty(self->historybuf, i);
 }
 
 static HistoryBuf*
 realloc_hb(HistoryBuf *old, unsigned int lines, unsigned int columns, ANSIBuf *as_ansi_buf) {
-    HistoryBuf *ans = alloc_historybuf(lines, columns, 0);
+    HistoryBuf *ans = alloc_historybuf(lines, columns, 0, OPT(scrollback_memory_limit));
     if (ans == NULL) { PyErr_NoMemory(); return NULL; }
     ans->pagerhist = old->pagerhist; old->pagerhist = NULL;
-    historybuf_rewrap(old, ans, as_ansi_buf);
+    historybuf_rewrap_lazily(old, ans, as_ansi_buf);
     return ans;
 }
 
@@ -288,7 +285,7 @@ index_selection(const Screen *self, Selections *selections, bool up) {
 
 #define INDEX_GRAPHICS(amtv) { \
     bool is_main = self->linebuf == self->main_linebuf; \
-    static ScrollData s; \
+    ScrollData s; \
     s.amt = amtv; s.limit = is_main ? -self->historybuf->ynum : 0; \
     s.has_margins = self->margin_top != 0 || self->margin_bottom != self->lines - 1; \
     s.margin_top = top; s.margin_bottom = bottom; \
@@ -464,7 +461,6 @@ reset_callbacks(Screen *self, PyObject *a UNUSED) {
 
 static void
 dealloc(Screen* self) {
-    pthread_mutex_destroy(&self->read_buf_lock);
     pthread_mutex_destroy(&self->write_buf_lock);
     Py_CLEAR(self->main_grman);
     Py_CLEAR(self->alt_grman);
@@ -485,11 +481,13 @@ dealloc(Screen* self) {
     Py_CLEAR(self->overlay_line.overlay_text);
     PyMem_Free(self->main_tabstops);
     free(self->pending_mode.buf);
+    free(self->read_buf);
     free(self->selections.items);
     free(self->url_ranges.items);
     free_hyperlink_pool(self->hyperlink_pool);
     free(self->as_ansi_buf.buf);
     free(self->last_rendered_window_char.canvas);
+    free(self->cell_data.cells); free(self->cell_data.damage);
     Py_TYPE(self)->tp_free((PyObject*)self);
 } // }}}
 
@@ -681,8 +679,7 @@ draw_combining_char(Screen *self, char_type ch) {
 }
 
 static void
-draw_codepoint(Screen *self, char_type och, bool from_input_stream) {
-    if (is_ignored_char(och)) return;
+check_for_activity_since_last_focus(Screen *self) {
     if (!self->has_activity_since_last_focus && !self->has_focus && self->callbacks != Py_None) {
         PyObject *ret = PyObject_CallMethod(self->callbacks, "on_activity_since_last_focus", NULL);
         if (ret == NULL) PyErr_Print();
@@ -691,6 +688,10 @@ draw_codepoint(Screen *self, char_type och, bool from_input_stream) {
             Py_DECREF(ret);
         }
     }
+}
+
+static void
+draw_char(Screen *self, char_type och, bool from_input_stream) {
     uint32_t ch = och < 256 ? self->g_charset[och] : och;
     if (UNLIKELY(is_combining_char(ch))) {
         if (UNLIKELY(is_flag_codepoint(ch))) {
@@ -734,11 +735,82 @@ draw_codepoint(Screen *self, char_type och, bool from_input_stream) {
     linebuf_mark_line_dirty(self->linebuf, self->cursor->y);
 }
 
+static void
+draw_codepoint(Screen *self, char_type och, bool from_input_stream) {
+    if (is_ignored_char(och)) return;
+    check_for_activity_since_last_focus(self);
+    draw_char(self, och, from_input_stream);
+}
+
 void
 screen_draw(Screen *self, uint32_t och, bool from_input_stream) {
     draw_codepoint(self, och, from_input_stream);
 }
 
+// Return the codepoint to store in the cell if och occupies exactly one cell
+// with no special handling needed, otherwise zero
+static inline char_type
+single_cell_char(const Screen *self, char_type och) {
+    if (LIKELY(0x20 <= och && och < 0x7f)) {
+        if (LIKELY(self->g_charset[och] == och)) return och;
+    } else if (is_ignored_char(och)) return 0;
+    const char_type ch = och < 256 ? self->g_charset[och] : och;
+    if (is_combining_char(ch) || ch == IMAGE_PLACEHOLDER_CHAR || wcwidth_std(ch) != 1) return 0;
+    return ch;
+}
+
+void
+screen_draw_run(Screen *self, const char_type *chars, size_t num) {
+    if (!num) return;
+    check_for_activity_since_last_focus(self);
+    size_t i = 0;
+    while (i < num) {
+        char_type ch = self->modes.mIRM ? 0 : single_cell_char(self, chars[i]);
+        if (!ch) {
+            if (!is_ignored_char(chars[i])) draw_char(self, chars[i], true);
+            i++;
+            continue;
+        }
+        if (self->cursor->x >= self->columns) {
+            if (self->modes.mDECAWM) {
+                linebuf_set_last_char_as_continuation(self->linebuf, self->cursor->y, true);
+                screen_carriage_return(self);
+                screen_linefeed(self);
+            } else self->cursor->x = self->columns - 1;
+        }
+        // fill as many cells on the current line as possible and do the
+        // per line bookkeeping once
+        linebuf_init_line(self->linebuf, self->cursor->y);
+        CPUCell *cpu_cells = self->linebuf->line->cpu_cells;
+        GPUCell *gpu_cells = self->linebuf->line->gpu_cells;
+        const CellAttrs attrs = cursor_to_attrs(self->cursor, 1);
+        const color_type fg = self->cursor->fg & COL_MASK, bg = self->cursor->bg & COL_MASK;
+        color_type decoration_fg = self->cursor->decoration_fg & COL_MASK;
+        CellAttrs hyperlink_attrs = attrs;
+        const bool underline_hyperlink = OPT(underline_hyperlinks) == UNDERLINE_ALWAYS && self->active_hyperlink_id;
+        if (underline_hyperlink) {
+            decoration_fg = ((OPT(url_color) & COL_MASK) << 8) | 2;
+            hyperlink_attrs.decoration = OPT(url_style);
+        }
+        index_type x = self->cursor->x;
+        while (true) {
+            CPUCell *c = cpu_cells + x; GPUCell *g = gpu_cells + x;
+            c->ch = ch; c->hyperlink_id = self->active_hyperlink_id;
+            memset(c->cc_idx, 0, sizeof(c->cc_idx));
+            g->attrs = underline_hyperlink ? hyperlink_attrs : attrs;
+            g->fg = fg; g->bg = bg; g->decoration_fg = decoration_fg;
+            self->last_graphic_char = ch;
+            x++; i++;
+            if (i >= num || x >= self->columns) break;
+            if (!(ch = single_cell_char(self, chars[i]))) break;
+        }
+        self->cursor->x = x;
+        self->is_dirty = true;
+        if (selection_has_screen_line(&self->selections, self->cursor->y)) clear_selection(&self->selections);
+        linebuf_mark_line_dirty(self->linebuf, self->cursor->y);
+    }
+}
+
 void
 screen_align(Screen *self) {
     self->margin_top = 0; self->margin_bottom = self->lines - 1;
@@ -1927,7 +1999,15 @@ screen_repeat_character(Screen *self, unsigned int count) {
     if (self->last_graphic_char) {
         if (count == 0) count = 1;
         unsigned int num = MIN(count, CSI_REP_MAX_REPETITIONS);
-        while (num-- > 0) screen_draw(self, self->last_graphic_char, false);
+        const char_type ch = self->last_graphic_char;
+        char_type buf[512];
+        for (size_t i = 0; i < arraysz(buf) && i < num; i++) buf[i] = ch;
+        while (num > 0) {
+            const unsigned int n = MIN(num, arraysz(buf));
+            screen_draw_run(self, buf, n);
+            num -= n;
+        }
+        self->last_graphic_char = ch;
     }
 }
 
@@ -2410,10 +2490,29 @@ get_line_edge_colors(Screen *self, color_type *left, color_type *right) {
 }
 
 
+static bool
+ensure_cell_data_space(Screen *self) {
+    if (self->cell_data.lines == self->lines && self->cell_data.columns == self->columns) return false;
+    free(self->cell_data.cells); free(self->cell_data.damage);
+    self->cell_data.cells = calloc((size_t)self->lines * self->columns, sizeof(GPUCell));
+    self->cell_data.damage = calloc(self->lines, sizeof(XRange));
+    if (!self->cell_data.cells || !self->cell_data.damage) fatal("Out of memory allocating cell data for the GPU");
+    self->cell_data.lines = self->lines; self->cell_data.columns = self->columns;
+    return true;
+}
+
 static void
-update_line_data(Line *line, unsigned int dest_y, uint8_t *data) {
-    size_t base = sizeof(GPUCell) * dest_y * line->xnum;
-    memcpy(data + base, line->gpu_cells, line->xnum * sizeof(GPUCell));
+update_line_data(Screen *self, const GPUCell *cells, index_type y) {
+    // Copy the cells into the CPU side copy of the GPU cell buffer, recording
+    // the range of cells that actually changed so that only it is uploaded
+    GPUCell *dest = self->cell_data.cells + (size_t)y * self->columns;
+    index_type x = 0, limit = self->columns;
+    if (memcmp(dest, cells, sizeof(GPUCell) * limit) == 0) return;
+    while (memcmp(dest + x, cells + x, sizeof(GPUCell)) == 0) x++;
+    while (memcmp(dest + limit - 1, cells + limit - 1, sizeof(GPUCell)) == 0) limit--;
+    memcpy(dest + x, cells + x, sizeof(GPUCell) * (limit - x));
+    XRange *d = self->cell_data.damage + y;
+    d->x = MIN(d->x, x); d->x_limit = MAX(d->x_limit, limit);
 }
 
 
@@ -2558,8 +2657,13 @@ screen_update_only_line_graphics_data(Screen *self) {
 }
 
 void
-screen_update_cell_data(Screen *self, void *address, FONTS_DATA_HANDLE fonts_data, bool cursor_has_moved) {
+screen_update_cell_data(Screen *self, FONTS_DATA_HANDLE fonts_data, bool cursor_has_moved) {
     const bool is_overlay_active = screen_is_overlay_active(self);
+    if (ensure_cell_data_space(self)) {
+        for (index_type y = 0; y < self->lines; y++) self->cell_data.damage[y] = (XRange){.x_limit=self->columns};
+    } else {
+        for (index_type y = 0; y < self->lines; y++) self->cell_data.damage[y] = (XRange){.x=self->columns};
+    }
     unsigned int history_line_added_count = self->history_line_added_count;
     index_type lnum;
     bool was_dirty = self->is_dirty;
@@ -2578,7 +2682,7 @@ screen_update_cell_data(Screen *self, void *address, FONTS_DATA_HANDLE fonts_dat
             if (screen_has_marker(self)) mark_text_in_line(self->marker, self->historybuf->line);
             historybuf_mark_line_clean(self->historybuf, lnum);
         }
-        update_line_data(self->historybuf->line, y, address);
+        update_line_data(self, self->historybuf->line->gpu_cells, y);
     }
     for (index_type y = self->scrolled_by; y < self->lines; y++) {
         lnum = y - self->scrolled_by;
@@ -2591,14 +2695,14 @@ screen_update_cell_data(Screen *self, void *address, FONTS_DATA_HANDLE fonts_dat
             if (is_overlay_active && lnum == self->overlay_line.ynum) render_overlay_line(self, self->linebuf->line, fonts_data);
             linebuf_mark_line_clean(self->linebuf, lnum);
         }
-        update_line_data(self->linebuf->line, y, address);
+        update_line_data(self, self->linebuf->line->gpu_cells, y);
     }
     if (is_overlay_active && self->overlay_line.ynum + self->scrolled_by < self->lines) {
         if (self->overlay_line.is_dirty) {
             linebuf_init_line(self->linebuf, self->overlay_line.ynum);
             render_overlay_line(self, self->linebuf->line, fonts_data);
         }
-        update_overlay_line_data(self, address);
+        update_line_data(self, self->overlay_line.gpu_cells, self->overlay_line.ynum + self->scrolled_by);
     }
     if (was_dirty) clear_selection(&self->url_ranges);
 }
@@ -3230,12 +3334,6 @@ render_overlay_line(Screen *self, Line *line, FONTS_DATA_HANDLE fonts_data) {
 #undef ol
 }
 
-static void
-update_overlay_line_data(Screen *self, uint8_t *data) {
-    const size_t base = sizeof(GPUCell) * (self->overlay_line.ynum + self->scrolled_by) * self->columns;
-    memcpy(data + base, self->overlay_line.gpu_cells, self->columns * sizeof(GPUCell));
-}
-
 // }}}
 
 // Python interface {{{
@@ -3293,6 +3391,20 @@ as_text_for_history_buf(Screen *self, PyObject *args) {
     return as_text_history_buf(self->historybuf, args, &self->as_ansi_buf);
 }
 
+static PyObject*
+write_scrollback_for_pager(Screen *self, PyObject *fd) {
+    // Writes the same text, to the file descriptor fd, as window.as_text(as_ansi=True, add_history=True, add_wrap_markers=True)
+    // sanitized by Window.pipe_data(), without creating any Python objects for it
+    PagerWriter w = {.fd=PyLong_AsLong(fd)};
+    if (PyErr_Occurred()) return NULL;
+    if (self->linebuf == self->main_linebuf && historybuf_write_for_pager(self->historybuf, &w, &self->as_ansi_buf)) pager_writer_write(&w, (const uint8_t*)"\x1b[m", 3);
+    write_lines_for_pager(&w, self, get_range_line, self->lines, &self->as_ansi_buf, false);
+    pager_writer_flush(&w);
+    free(w.buf);
+    if (w.failed) return PyErr_SetFromErrno(PyExc_OSError);
+    return PyLong_FromSize_t(w.num_lines);
+}
+
 static PyObject*
 as_text_generic_wrapper(Screen *self, PyObject *args, get_line_func get_line) {
     return as_text_generic(args, self, get_line, self->lines, &self->as_ansi_buf, false);
@@ -3566,10 +3678,14 @@ static PyObject*
 draw(Screen *self, PyObject *src) {
     if (!PyUnicode_Check(src)) { PyErr_SetString(PyExc_TypeError, "A unicode string is required"); return NULL; }
     if (PyUnicode_READY(src) != 0) { return PyErr_NoMemory(); }
-    int kind = PyUnicode_KIND(src);
-    void *buf = PyUnicode_DATA(src);
     Py_ssize_t sz = PyUnicode_GET_LENGTH(src);
-    for (Py_ssize_t i = 0; i < sz; i++) screen_draw(self, PyUnicode_READ(kind, buf, i), true);
+    if (PyUnicode_KIND(src) == PyUnicode_4BYTE_KIND) screen_draw_run(self, PyUnicode_DATA(src), sz);
+    else {
+        Py_UCS4 *chars = PyUnicode_AsUCS4Copy(src);
+        if (!chars) return NULL;
+        screen_draw_run(self, chars, sz);
+        PyMem_Free(chars);
+    }
     Py_RETURN_NONE;
 }
 
@@ -4322,6 +4438,26 @@ scroll_to_next_mark(Screen *self, PyObject *args) {
     Py_RETURN_FALSE;
 }
 
+static PyObject*
+search_scrollback(Screen *self, PyObject *args) {
+    PyObject *query;
+    int backwards = 1;
+    if (!PyArg_ParseTuple(args, "U|p", &query, &backwards)) return NULL;
+    if (self->linebuf == self->alt_linebuf || (!backwards && self->scrolled_by < 2)) Py_RETURN_FALSE;
+    Py_UCS4 *q = PyUnicode_AsUCS4Copy(query);
+    if (!q) return NULL;
+    // Search the lines above the top line of the screen or, when going forwards, below it
+    HistorySearchResult r;
+    bool found = historybuf_search(self->historybuf, q, PyUnicode_GET_LENGTH(query), backwards ? self->scrolled_by : self->scrolled_by - 2, backwards, &r);
+    PyMem_Free(q);
+    if (!found) Py_RETURN_FALSE;
+    if (backwards) screen_history_scroll(self, r.lnum - self->scrolled_by + 1, true);
+    else screen_history_scroll(self, self->scrolled_by - r.lnum - 1, false);
+    screen_start_selection(self, r.start_x, 0, true, false, EXTEND_CELL);
+    screen_update_selection(self, r.end_x, 0, false, (SelectionUpdate){.ended=true});
+    Py_RETURN_TRUE;
+}
+
 static PyObject*
 marked_cells(Screen *self, PyObject *o UNUSED) {
     PyObject *ans = PyList_New(0);
@@ -4571,6 +4707,7 @@ static PyMethodDef methods[] = {
     MND(as_text, METH_VARARGS)
     MND(as_text_non_visual, METH_VARARGS)
     MND(as_text_for_history_buf, METH_VARARGS)
+    MND(write_scrollback_for_pager, METH_O)
     MND(as_text_alternate, METH_VARARGS)
     MND(cmd_output, METH_VARARGS)
     MND(tab, METH_NOARGS)
@@ -4609,6 +4746,7 @@ static PyMethodDef methods[] = {
     MND(set_marker, METH_VARARGS)
     MND(marked_cells, METH_NOARGS)
     MND(scroll_to_next_mark, METH_VARARGS)
+    MND(search_scrollback, METH_VARARGS)
     MND(update_only_line_graphics_data, METH_NOARGS)
     MND(bell, METH_NOARGS)
     {"select_graphic_rendition", (PyCFunction)_select_graphic_rendition, METH_VARARGS, ""},
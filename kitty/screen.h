@@ -8,6 +8,7 @@
 
 #include "graphics.h"
 #include "monotonic.h"
+#include <stdatomic.h>
 #define MAX_PARAMS 256
 
 typedef enum ScrollTypes { SCROLL_LINE = -999999, SCROLL_PAGE, SCROLL_FULL } ScrollType;
@@ -100,6 +101,11 @@ typedef struct {
         unsigned int cursor_x, cursor_y, scrolled_by;
         index_type lines, columns;
     } last_rendered;
+    struct {
+        GPUCell *cells;  // the cell data as last sent to the GPU
+        XRange *damage;  // per line, the cells changed by the last call to screen_update_cell_data
+        index_type lines, columns;
+    } cell_data;
     bool use_latin1, is_dirty, scroll_changed, reload_all_gpu_data;
     Cursor *cursor;
     Savepoint main_savepoint, alt_savepoint;
@@ -116,10 +122,23 @@ typedef struct {
     uint32_t parser_buf[PARSER_BUF_SZ];
     unsigned int parser_state, parser_text_start, parser_buf_pos;
     bool parser_has_pending_text;
-    uint8_t read_buf[READ_BUF_SZ], *write_buf;
-    monotonic_t new_input_at;
-    size_t read_buf_sz, write_buf_sz, write_buf_used;
-    pthread_mutex_t read_buf_lock, write_buf_lock;
+    // read_buf is a single producer, single consumer ring buffer. Only the
+    // I/O thread advances read_buf_head and only the main thread advances
+    // read_buf_tail, so neither ever waits for the other. The I/O thread
+    // allocates, grows and frees read_buf, which it does only while it is
+    // empty, so the main thread never sees it change while using it.
+    uint8_t *read_buf, *write_buf;
+    size_t read_buf_sz;  // a power of two between MIN_READ_BUF_SZ and READ_BUF_SZ
+    _Atomic(size_t) read_buf_head, read_buf_tail;
+    monotonic_t read_buf_used_at;  // only used by the I/O thread
+    bool read_buf_filled;  // only used by the I/O thread
+    // How long to wait for more input before parsing, picked by the I/O thread from the input rate
+    _Atomic(monotonic_t) input_delay;
+    struct { double bytes_per_sec; monotonic_t measured_at; } input_rate;  // only used by the I/O thread
+    _Atomic(bool) read_buf_starved;  // set by the I/O thread when it stops reading because read_buf is full
+    _Atomic(monotonic_t) new_input_at;
+    size_t write_buf_sz, write_buf_used;
+    pthread_mutex_t write_buf_lock;
 
     CursorRenderInfo cursor_render_info;
     unsigned int render_unfocused_cursor;
@@ -172,6 +191,8 @@ typedef struct {
 
 void parse_worker(Screen *screen, PyObject *dump_callback, monotonic_t now);
 void parse_worker_dump(Screen *screen, PyObject *dump_callback, monotonic_t now);
+bool parse_worker_is_python_free(Screen *screen, size_t *head);
+void parse_worker_until(Screen *screen, size_t head, monotonic_t now);
 void screen_align(Screen*);
 void screen_restore_cursor(Screen *);
 void screen_save_cursor(Screen *);
@@ -185,6 +206,7 @@ void screen_cursor_back(Screen *self, unsigned int count/*=1*/, int move_directi
 void screen_erase_in_line(Screen *, unsigned int, bool);
 void screen_erase_in_display(Screen *, unsigned int, bool);
 void screen_draw(Screen *screen, uint32_t codepoint, bool);
+void screen_draw_run(Screen *screen, const char_type *chars, size_t num);
 void screen_ensure_bounds(Screen *self, bool use_margins, bool cursor_was_within_margins);
 void screen_toggle_screen_buffer(Screen *self, bool, bool);
 void screen_normal_keypad_mode(Screen *self);
@@ -249,7 +271,7 @@ void screen_apply_selection(Screen *self, void *address, size_t size);
 bool screen_is_selection_dirty(Screen *self);
 bool screen_has_selection(Screen*);
 bool screen_invert_colors(Screen *self);
-void screen_update_cell_data(Screen *self, void *address, FONTS_DATA_HANDLE, bool cursor_has_moved);
+void screen_update_cell_data(Screen *self, FONTS_DATA_HANDLE, bool cursor_has_moved);
 bool screen_is_cursor_visible(const Screen *self);
 bool screen_selection_range_for_line(Screen *self, index_type y, index_type *start, index_type *end);
 bool screen_selection_range_for_word(Screen *self, const index_type x, const index_type y, index_type *, index_type *, index_type *start, index_type *end, bool);
@@ -373,6 +373,31 @@ cell_update_uniform_block(ssize_t vao_idx, Screen *screen, int uniform_buffer, c
     unmap_vao_buffer(vao_idx, uniform_buffer); rd = NULL;
 }
 
+static void
+upload_cell_data(ssize_t vao_idx, Screen *screen, bool everything) {
+    CELL_BUFFERS;
+    const size_t columns = screen->columns;
+    if (everything) {
+        const size_t sz = sizeof(GPUCell) * screen->lines * columns;
+        alloc_vao_buffer(vao_idx, sz, cell_data_buffer, GL_DYNAMIC_DRAW);
+        update_vao_buffer(vao_idx, cell_data_buffer, 0, sz, screen->cell_data.cells);
+        return;
+    }
+    // Upload only the damaged cells, merging ranges that are separated by
+    // less than a line of undamaged cells to keep the number of calls down
+    size_t start = SIZE_MAX, end = 0;
+#define upload if (start < end) update_vao_buffer(vao_idx, cell_data_buffer, start * sizeof(GPUCell), (end - start) * sizeof(GPUCell), screen->cell_data.cells + start)
+    for (index_type y = 0; y < screen->lines; y++) {
+        const XRange *d = screen->cell_data.damage + y;
+        if (d->x >= d->x_limit) continue;
+        if (start != SIZE_MAX && y * columns + d->x > end + columns) { upload; start = SIZE_MAX; }
+        if (start == SIZE_MAX) start = y * columns + d->x;
+        end = y * columns + d->x_limit;
+    }
+    upload;
+#undef upload
+}
+
 static bool
 cell_prepare_to_render(ssize_t vao_idx, Screen *screen, GLfloat xstart, GLfloat ystart, GLfloat dx, GLfloat dy, FONTS_DATA_HANDLE fonts_data) {
     size_t sz;
@@ -388,10 +413,8 @@ cell_prepare_to_render(ssize_t vao_idx, Screen *screen, GLfloat xstart, GLfloat
     bool screen_resized = screen->last_rendered.columns != screen->columns || screen->last_rendered.lines != screen->lines;
 
     if (screen->reload_all_gpu_data || screen->scroll_changed || screen->is_dirty || screen_resized || (disable_ligatures && cursor_pos_changed)) {
-        sz = sizeof(GPUCell) * screen->lines * screen->columns;
-        address = alloc_and_map_vao_buffer(vao_idx, sz, cell_data_buffer, GL_STREAM_DRAW, GL_WRITE_ONLY);
-        screen_update_cell_data(screen, address, fonts_data, disable_ligatures && cursor_pos_changed);
-        unmap_vao_buffer(vao_idx, cell_data_buffer); address = NULL;
+        screen_update_cell_data(screen, fonts_data, disable_ligatures && cursor_pos_changed);
+        upload_cell_data(vao_idx, screen, screen->reload_all_gpu_data || screen_resized);
         changed = true;
     }
 
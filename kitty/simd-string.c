@@ -0,0 +1,60 @@
+/*
+ * simd-string.c
+ * Copyright (C) 2024 Kovid Goyal <kovid at kovidgoyal.net>
+ *
+ * Distributed under terms of the GPL3 license.
+ */
+
+#include "simd-string.h"
+
+#define is_continuation_byte(b) (((b) & 0xc0) == 0x80)
+
+// Decode the longest prefix of src that consists only of complete, valid
+// UTF-8 sequences for non-control codepoints into dest. Decoding stops at
+// the first C0, DEL or C1 control, invalid or truncated sequence, leaving it
+// for the byte at a time decoder, which means the state of that decoder is
+// always UTF8_ACCEPT before and after this function. Returns the number of
+// bytes consumed and sets num_decoded to the number of codepoints written.
+size_t
+utf8_decode_text_run(const uint8_t *src, const size_t src_sz, uint32_t *dest, const size_t dest_sz, size_t *num_decoded) {
+    size_t i = 0, d = 0;
+    while (i < src_sz && d < dest_sz) {
+        const size_t limit = dest_sz - d < src_sz - i ? dest_sz - d : src_sz - i;
+        const size_t n = find_printable_ascii_run(src + i, limit);
+        for (size_t k = 0; k < n; k++) dest[d + k] = src[i + k];
+        i += n; d += n;
+        while (i < src_sz && d < dest_sz) {
+            const uint8_t b0 = src[i];
+            uint32_t ch;
+            if (b0 < 0x80) {
+                if (b0 < 0x20 || b0 == 0x7f) goto end;
+                break;  // back to the vectorized ASCII scan
+            }
+            if (b0 < 0xc2) goto end;
+            if (b0 < 0xe0) {
+                if (src_sz - i < 2 || !is_continuation_byte(src[i+1])) goto end;
+                ch = ((b0 & 0x1fu) << 6) | (src[i+1] & 0x3fu);
+                if (ch < 0xa0) goto end;  // C1 control
+                i += 2;
+            } else if (b0 < 0xf0) {
+                if (src_sz - i < 3) goto end;
+                const uint8_t b1 = src[i+1], b2 = src[i+2];
+                const uint8_t lo = b0 == 0xe0 ? 0xa0 : 0x80, hi = b0 == 0xed ? 0x9f : 0xbf;
+                if (b1 < lo || b1 > hi || !is_continuation_byte(b2)) goto end;
+                ch = ((b0 & 0xfu) << 12) | ((b1 & 0x3fu) << 6) | (b2 & 0x3fu);
+                i += 3;
+            } else if (b0 < 0xf5) {
+                if (src_sz - i < 4) goto end;
+                const uint8_t b1 = src[i+1], b2 = src[i+2], b3 = src[i+3];
+                const uint8_t lo = b0 == 0xf0 ? 0x90 : 0x80, hi = b0 == 0xf4 ? 0x8f : 0xbf;
+                if (b1 < lo || b1 > hi || !is_continuation_byte(b2) || !is_continuation_byte(b3)) goto end;
+                ch = ((b0 & 0x7u) << 18) | ((b1 & 0x3fu) << 12) | ((b2 & 0x3fu) << 6) | (b3 & 0x3fu);
+                i += 4;
+            } else goto end;
+            dest[d++] = ch;
+        }
+    }
+end:
+    *num_decoded = d;
+    return i;
+}
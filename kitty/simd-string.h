@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2024 Kovid Goyal <kovid at kovidgoyal.net>
+ *
+ * Distributed under terms of the GPL3 license.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+size_t utf8_decode_text_run(const uint8_t *src, const size_t src_sz, uint32_t *dest, const size_t dest_sz, size_t *num_decoded);
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Return the length of the run of printable ASCII bytes (0x20 - 0x7e) at the
+// start of p. Uses the widest vector unit available at compile time, with a
+// scalar loop for the tail.
+static inline size_t
+find_printable_ascii_run(const uint8_t *p, const size_t sz) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i lower32 = _mm256_set1_epi8(0x1f), upper32 = _mm256_set1_epi8(0x7f);
+    for (; i + 32 <= sz; i += 32) {
+        // bytes >= 0x80 are negative as signed chars and so fail the first comparison
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        const __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, lower32), _mm256_cmpgt_epi8(upper32, v));
+        const uint32_t mask = (uint32_t)_mm256_movemask_epi8(ok);
+        if (mask != 0xffffffffu) return i + __builtin_ctz(~mask);
+    }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+    const __m128i lower = _mm_set1_epi8(0x1f), upper = _mm_set1_epi8(0x7f);
+    for (; i + 16 <= sz; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        const __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, lower), _mm_cmpgt_epi8(upper, v));
+        const unsigned mask = (unsigned)_mm_movemask_epi8(ok);
+        if (mask != 0xffffu) return i + __builtin_ctz(~mask);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t lower = vdupq_n_u8(0x20), upper = vdupq_n_u8(0x7e);
+    for (; i + 16 <= sz; i += 16) {
+        const uint8x16_t v = vld1q_u8(p + i);
+        const uint8x16_t ok = vandq_u8(vcgeq_u8(v, lower), vcleq_u8(v, upper));
+        if (vminvq_u8(ok) != 0xff) break;  // the scalar loop below finds the exact position
+    }
+#endif
+    for (; i < sz; i++) {
+        if (p[i] < 0x20 || p[i] > 0x7e) break;
+    }
+    return i;
+}
@@ -39,7 +39,7 @@ typedef struct {
     float cursor_beam_thickness;
     float cursor_underline_thickness;
     unsigned int url_style;
-    unsigned int scrollback_pager_history_size;
+    unsigned int scrollback_pager_history_size, scrollback_memory_limit;
     bool scrollback_fill_enlarged_window;
     char_type *select_by_word_characters;
     char_type *select_by_word_characters_forward;
@@ -87,7 +87,7 @@ class TabDict(TypedDict):
 
 class SpecialWindowInstance(NamedTuple):
     cmd: Optional[List[str]]
-    stdin: Optional[bytes]
+    stdin: Optional[Union[bytes, int]]
     override_title: Optional[str]
     cwd_from: Optional[CwdRequest]
     cwd: Optional[str]
@@ -99,7 +99,7 @@ class SpecialWindowInstance(NamedTuple):
 
 def SpecialWindow(
     cmd: Optional[List[str]],
-    stdin: Optional[bytes] = None,
+    stdin: Optional[Union[bytes, int]] = None,
     override_title: Optional[str] = None,
     cwd_from: Optional[CwdRequest] = None,
     cwd: Optional[str] = None,
@@ -434,7 +434,7 @@ def launch_child(
         self,
         use_shell: bool = False,
         cmd: Optional[List[str]] = None,
-        stdin: Optional[bytes] = None,
+        stdin: Optional[Union[bytes, int]] = None,
         cwd_from: Optional[CwdRequest] = None,
         cwd: Optional[str] = None,
         env: Optional[Dict[str, str]] = None,
@@ -500,7 +500,7 @@ def new_window(
         self,
         use_shell: bool = True,
         cmd: Optional[List[str]] = None,
-        stdin: Optional[bytes] = None,
+        stdin: Optional[Union[bytes, int]] = None,
         override_title: Optional[str] = None,
         cwd_from: Optional[CwdRequest] = None,
         cwd: Optional[str] = None,
@@ -326,6 +326,16 @@ def pagerhist(screen: Screen, as_ansi: bool = False, add_wrap_markers: bool = Tr
     return pht
 
 
+def anonymous_file() -> int:
+    ' Return a file descriptor to a new, unnamed file, in memory when possible '
+    if hasattr(os, 'memfd_create'):
+        with suppress(OSError):
+            return os.memfd_create('kitty-scrollback', os.MFD_CLOEXEC)
+    from tempfile import TemporaryFile
+    with TemporaryFile() as f:
+        return os.dup(f.fileno())
+
+
 def as_text(
     screen: Screen,
     as_ansi: bool = False,
@@ -552,6 +562,7 @@ def __init__(
         self.actions_on_focus_change: List[Callable[['Window', bool], None]] = []
         self.actions_on_removal: List[Callable[['Window'], None]] = []
         self.current_marker_spec: Optional[Tuple[str, Union[str, Tuple[Tuple[int, str], ...]]]] = None
+        self.last_scrollback_search = ''
         self.kitten_result_processors: List[Callable[['Window', Any], None]] = []
         self.pty_resized_once = False
         self.last_reported_pty_size = (-1, -1, -1, -1)
@@ -1660,10 +1671,19 @@ def clear_screen(self, reset: bool = False, scrollback: bool = False) -> None:
 
     @ac('cp', 'Show scrollback in a pager like less')
     def show_scrollback(self) -> None:
-        text = self.as_text(as_ansi=True, add_history=True, add_wrap_markers=True)
-        data = self.pipe_data(text, has_wrap_markers=True)
+        # The scrollback is written by native code to an anonymous file that
+        # becomes the STDIN of the pager, which is much faster and uses much
+        # less memory than creating the text with as_text() and pipe_data()
+        fd = anonymous_file()
+        try:
+            num_lines = self.screen.write_scrollback_for_pager(fd)
+            os.lseek(fd, 0, os.SEEK_SET)
+        except Exception:
+            os.close(fd)
+            raise
+        input_line_number = num_lines - (self.screen.lines - 1) - self.screen.scrolled_by
         cursor_on_screen = self.screen.scrolled_by < self.screen.lines - self.screen.cursor.y
-        get_boss().display_scrollback(self, data['text'], data['input_line_number'], report_cursor=cursor_on_screen)
+        get_boss().display_scrollback(self, fd, input_line_number, report_cursor=cursor_on_screen)
 
     def show_cmd_output(self, which: CommandOutput, title: str = 'Command output', as_ansi: bool = True, add_wrap_markers: bool = True) -> None:
         text = self.cmd_output(which, as_ansi=as_ansi, add_wrap_markers=add_wrap_markers)
@@ -1815,6 +1835,32 @@ def scroll_to_prompt(self, num_of_prompts: int = -1) -> Optional[bool]:
             return None
         return True
 
+    @ac('sc', '''
+        Search the scrollback buffer for the specified text, when in main screen
+        Scrolls to the nearest line above the top of the screen that contains the text
+        and selects it, so running the action again jumps to the next older match. Case
+        is ignored for ASCII letters. If no text is specified, you are asked for it.
+        For example::
+
+            map f1 search_scrollback
+            map f2 search_scrollback error:
+        ''')
+    def search_scrollback(self, query: str = '') -> Optional[bool]:
+        if not self.screen.is_main_linebuf():
+            return True
+
+        def do_search(query: str) -> None:
+            if query:
+                self.last_scrollback_search = query
+                self.screen.search_scrollback(query)
+
+        if query:
+            do_search(query)
+        else:
+            get_boss().get_line(
+                _('Enter the text to search the scrollback for below.'), do_search, window=self, initial_value=self.last_scrollback_search)
+        return None
+
     @ac('sc', 'Scroll prompt to the top of the screen, filling screen with empty lines, when in main screen')
     def scroll_prompt_to_top(self, clear_scrollback: bool = False) -> Optional[bool]:
         if self.screen.is_main_linebuf():
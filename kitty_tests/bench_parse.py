@@ -0,0 +1,315 @@
+#!/usr/bin/env python
+# License: GPL v3 Copyright: 2024, Kovid Goyal <kovid at kovidgoyal.net>
+
+# Headless benchmark for the VT parser and the cell data update path. Run it
+# with:
+#   kitty +launch kitty_tests/bench_parse.py --help
+
+import ctypes
+import ctypes.util
+import os
+import sys
+import tracemalloc
+from argparse import ArgumentParser
+from base64 import standard_b64encode
+from random import Random
+from string import ascii_letters, digits
+from time import perf_counter_ns
+from typing import Callable, Dict, Iterator, List, Optional, Sequence, Tuple, Union
+
+from kitty.fast_data_types import Screen, parse_bytes, set_options, test_update_cell_data
+from kitty.pty_recording import chunks_for_window
+
+GPU_CELL_SIZE = 20
+
+
+def lines_to_size(rng: Random, size: int, make_line: Callable[[Random], str]) -> bytes:
+    # Generate a pool of lines and repeat them in random order so that large
+    # corpora are cheap to generate but not trivially repetitive
+    pool = [make_line(rng).encode('utf-8') for _ in range(512)]
+    parts: List[bytes] = []
+    total = 0
+    while total < size:
+        x = pool[rng.randrange(len(pool))]
+        parts.append(x)
+        total += len(x)
+    return b''.join(parts)
+
+
+def words(rng: Random, count: int, alphabet: str = ascii_letters + digits) -> Iterator[str]:
+    for _ in range(count):
+        yield ''.join(rng.choices(alphabet, k=rng.randint(1, 12)))
+
+
+def ascii_corpus(rng: Random, size: int) -> bytes:
+    # build logs and cat-ed source files
+    def line(rng: Random) -> str:
+        if rng.random() < 0.1:
+            return '\r\n'
+        pct = rng.randint(0, 100)
+        return f'[{pct:3d}%] Building CXX object ' + '/'.join(words(rng, rng.randint(2, 6))) + '.cpp.o ' + ' '.join(words(rng, rng.randint(0, 8))) + '\r\n'
+    return lines_to_size(rng, size, line)
+
+
+def sgr_corpus(rng: Random, size: int) -> bytes:
+    # compiler diagnostics, ls --color, syntax highlighted diffs
+    def sgr(rng: Random) -> str:
+        r = rng.random()
+        if r < 0.3:
+            return f'\x1b[{rng.randint(30, 37)}m'
+        if r < 0.5:
+            return f'\x1b[38;5;{rng.randint(0, 255)}m'
+        if r < 0.7:
+            return f'\x1b[38;2;{rng.randint(0, 255)};{rng.randint(0, 255)};{rng.randint(0, 255)}m'
+        if r < 0.8:
+            return f'\x1b[48;5;{rng.randint(0, 255)}m'
+        if r < 0.9:
+            return rng.choice(('\x1b[1m', '\x1b[3m', '\x1b[4m', '\x1b[4:3m', '\x1b[22m', '\x1b[23m'))
+        return '\x1b[m'
+
+    def line(rng: Random) -> str:
+        return ''.join(sgr(rng) + w + ' ' for w in words(rng, rng.randint(1, 15))) + '\x1b[m\r\n'
+    return lines_to_size(rng, size, line)
+
+
+def unicode_corpus(rng: Random, size: int) -> bytes:
+    # CJK text, emoji and combining characters mixed with ASCII
+    cjk = [chr(x) for x in range(0x4e00, 0x4e00 + 2000)] + [chr(x) for x in range(0x3041, 0x3097)]
+    emoji = ['😀', '🎉', '👍🏽', '🇺🇸', '❤️', '👨‍👩‍👧', '🍀', '☃', '🎩', '💜']
+    other = ['é', 'ñ', 'ü', 'é', 'α', 'β', 'Ж', 'ש', '—', '…', '→', '│', '─']
+
+    def line(rng: Random) -> str:
+        parts = []
+        for _ in range(rng.randint(1, 40)):
+            r = rng.random()
+            if r < 0.5:
+                parts.append(''.join(rng.choices(cjk, k=rng.randint(1, 6))))
+            elif r < 0.6:
+                parts.append(rng.choice(emoji))
+            elif r < 0.75:
+                parts.append(rng.choice(other))
+            else:
+                parts.append(next(words(rng, 1)) + ' ')
+        return ''.join(parts) + '\r\n'
+    return lines_to_size(rng, size, line)
+
+
+def tui_corpus(rng: Random, size: int, lines: int = 50, columns: int = 200) -> bytes:
+    # full screen redraws with absolute cursor positioning, the way vim and
+    # htop update the screen
+    frames: List[bytes] = []
+    for _ in range(16):
+        out = ['\x1b[?2026h\x1b[H']
+        for y in range(1, lines + 1):
+            r = rng.random()
+            if r < 0.2:
+                # meter bar
+                used = rng.randint(0, columns - 20)
+                out.append(f'\x1b[{y};1H\x1b[1m{y:3d}\x1b[m[\x1b[32m' + '|' * used + '\x1b[m' + ' ' * (columns - 20 - used) + f'{rng.random()*100:5.1f}%]')
+            elif r < 0.4:
+                # partial update of a few cells
+                x = rng.randint(1, columns - 10)
+                out.append(f'\x1b[{y};{x}H\x1b[7m{rng.randint(0, 99999):5d}\x1b[27m')
+            else:
+                text = ' '.join(words(rng, rng.randint(1, 20)))[:columns - 8]
+                out.append(f'\x1b[{y};1H\x1b[38;5;{rng.randint(0, 255)}m{y:4d} \x1b[m{text}\x1b[K')
+        out.append(f'\x1b[{rng.randint(1, lines)};{rng.randint(1, columns)}H\x1b[?2026l')
+        frames.append(''.join(out).encode('utf-8'))
+    parts: List[bytes] = []
+    total = 0
+    while total < size:
+        x = frames[rng.randrange(len(frames))]
+        parts.append(x)
+        total += len(x)
+    return b'\x1b[?1049h' + b''.join(parts) + b'\x1b[?1049l'
+
+
+def graphics_corpus(rng: Random, size: int) -> bytes:
+    # RGBA images transmitted in chunks and deleted again, as done by image
+    # viewers and plotting tools
+    parts: List[bytes] = []
+    total = 0
+    image_id = 0
+    while total < size:
+        image_id += 1
+        w, h = rng.randint(16, 128), rng.randint(16, 128)
+        data = standard_b64encode(rng.getrandbits(w * h * 32).to_bytes(w * h * 4, 'little'))
+        chunks = [data[i:i+4096] for i in range(0, len(data), 4096)]
+        for i, chunk in enumerate(chunks):
+            more = int(i < len(chunks) - 1)
+            if i == 0:
+                header = f'a=T,q=2,f=32,s={w},v={h},i={image_id},m={more}'
+            else:
+                header = f'm={more}'
+            parts.append(b'\x1b_G' + header.encode('ascii') + b';' + chunk + b'\x1b\\')
+            total += len(parts[-1])
+        parts.append(f'\r\nimage {image_id}\r\n'.encode('ascii'))
+        if image_id % 8 == 0:
+            parts.append(b'\x1b_Ga=d,q=2\x1b\\')
+    return b''.join(parts)
+
+
+corpora: Dict[str, Callable[[Random, int], bytes]] = {
+    'ascii': ascii_corpus,
+    'sgr': sgr_corpus,
+    'unicode': unicode_corpus,
+    'tui': tui_corpus,
+    'graphics': graphics_corpus,
+}
+
+
+class Callbacks:
+
+    def __getattr__(self, name: str) -> Callable[..., None]:
+        # The benchmark does not care about any of the callbacks into Python
+        return self.ignore
+
+    def ignore(self, *a: object, **kw: object) -> None:
+        pass
+
+    def on_activity_since_last_focus(self) -> bool:
+        return True
+
+
+def heap_in_use() -> Optional[int]:
+    # Bytes currently allocated from the C heap, only available with glibc
+    class mallinfo2(ctypes.Structure):
+        _fields_ = [(x, ctypes.c_size_t) for x in (
+            'arena', 'ordblks', 'smblks', 'hblks', 'hblkhd', 'usmblks', 'fsmblks', 'uordblks', 'fordblks', 'keepcost')]
+    try:
+        libc = ctypes.CDLL(ctypes.util.find_library('c'))
+        f = libc.mallinfo2
+    except Exception:
+        return None
+    f.restype = mallinfo2
+    m = f()
+    return int(m.uordblks + m.hblkhd)
+
+
+Chunks = Sequence[Union[bytes, memoryview]]
+
+
+def split_into_chunks(data: bytes, chunk_size: int) -> Chunks:
+    mv = memoryview(data)
+    return [mv[pos:pos + chunk_size] for pos in range(0, len(data), chunk_size)]
+
+
+def feed(chunks: Chunks, args: 'BenchArgs', render: bool) -> Tuple[int, int, int]:
+    cb = Callbacks()
+    screen = Screen(cb, args.lines, args.columns, args.scrollback, 10, 20, 0, cb)
+    cell_buf = bytearray(GPU_CELL_SIZE * args.lines * args.columns)
+    parse_time = render_time = frames = 0
+    for chunk in chunks:
+        st = perf_counter_ns()
+        parse_bytes(screen, chunk)
+        parse_time += perf_counter_ns() - st
+        if render:
+            st = perf_counter_ns()
+            test_update_cell_data(screen, cell_buf)
+            render_time += perf_counter_ns() - st
+            frames += 1
+    return parse_time, render_time, frames
+
+
+class BenchArgs:
+    lines: int = 50
+    columns: int = 200
+    scrollback: int = 10000
+    chunk_size: int = 64 * 1024
+    size: float = 16
+    repeat: int = 3
+    render: bool = True
+    seed: str = 'kitty'
+    corpus: List[str] = []
+    save_corpus: str = ''
+    replay: str = ''
+    window_id: int = 0
+
+
+def run_benchmark(name: str, chunks: Chunks, args: BenchArgs) -> None:
+    best_parse = best_render = sys.maxsize
+    frames = 0
+    size = sum(len(c) for c in chunks)
+    for _ in range(args.repeat):
+        parse_time, render_time, frames = feed(chunks, args, args.render)
+        best_parse, best_render = min(best_parse, parse_time), min(best_render, render_time)
+
+    heap_before = heap_in_use()
+    blocks_before = sys.getallocatedblocks()
+    tracemalloc.start()
+    feed(chunks, args, args.render)
+    _, python_peak = tracemalloc.get_traced_memory()
+    tracemalloc.stop()
+    blocks = sys.getallocatedblocks() - blocks_before
+    heap_after = heap_in_use()
+
+    mb = size / (1024 * 1024)
+    parse_s = best_parse / 1e9
+    print(f'{name:10s} {mb:8.1f} {mb / parse_s:10.1f} {best_parse / max(1, size):8.2f}', end='')
+    if args.render:
+        print(f' {best_render / max(1, frames) / 1e3:12.1f}', end='')
+    heap = '-' if heap_before is None or heap_after is None else f'{(heap_after - heap_before) / 1024:.0f}'
+    print(f' {blocks:10d} {python_peak / 1024:10.0f} {heap:>10s}')
+
+
+def main() -> None:
+    parser = ArgumentParser(description='Benchmark the terminal parser and cell data updates with no GUI')
+    parser.add_argument('corpus', nargs='*', help=f'The corpora to benchmark, defaults to all. Choices: {", ".join(corpora)}')
+    parser.add_argument('--size', type=float, default=BenchArgs.size, help='Size of each generated corpus in MB')
+    parser.add_argument('--repeat', type=int, default=BenchArgs.repeat, help='Number of timed runs, the best one is reported')
+    parser.add_argument('--lines', type=int, default=BenchArgs.lines, help='Number of lines in the screen')
+    parser.add_argument('--columns', type=int, default=BenchArgs.columns, help='Number of columns in the screen')
+    parser.add_argument('--scrollback', type=int, default=BenchArgs.scrollback, help='Number of lines of scrollback')
+    parser.add_argument(
+        '--chunk-size', type=int, default=BenchArgs.chunk_size,
+        help='Number of bytes to parse at a time, the cell data is updated after every chunk, like a rendered frame')
+    parser.add_argument('--no-render', dest='render', action='store_false', help='Only benchmark parsing, skip the cell data updates')
+    parser.add_argument('--seed', default=BenchArgs.seed, help='Seed for the corpus generator')
+    parser.add_argument(
+        '--save-corpus', default='', metavar='DIR',
+        help='Write the generated corpora to files in the specified directory, useful for feeding them to a real terminal')
+    parser.add_argument(
+        '--replay', default='', metavar='RECORDING',
+        help='Benchmark a recording made with kitty --record-pty instead of the generated corpora. It is parsed in the'
+        ' chunks it was originally read in and the cell data is updated after every chunk.')
+    parser.add_argument(
+        '--window-id', type=int, default=BenchArgs.window_id,
+        help='The window from the recording to replay, defaults to the first window that produced output')
+    args = parser.parse_args(namespace=BenchArgs())
+    names = [] if args.replay else (args.corpus or list(corpora))
+    for name in names:
+        if name not in corpora:
+            raise SystemExit(f'Unknown corpus: {name}')
+
+    if args.render:
+        from kitty.fonts.render import setup_for_testing
+        ctx = setup_for_testing()
+        ctx.__enter__()
+    else:
+        from kitty.options.types import defaults
+        set_options(defaults)
+    try:
+        print(f'Screen: {args.columns}x{args.lines} scrollback: {args.scrollback} chunk size: {args.chunk_size} repeats: {args.repeat}')
+        print(f'{"corpus":10s} {"MB":>8s} {"MB/s":>10s} {"ns/byte":>8s}', end='')
+        if args.render:
+            print(f' {"µs/frame":>12s}', end='')
+        print(f' {"py blocks":>10s} {"py peak KB":>10s} {"heap KB":>10s}')
+        if args.replay:
+            with open(args.replay, 'rb') as f:
+                recording = f.read()
+            run_benchmark('replay', [c.data for c in chunks_for_window(recording, args.window_id)], args)
+        for name in names:
+            data = corpora[name](Random(f'{args.seed}-{name}'), int(args.size * 1024 * 1024))
+            if args.save_corpus:
+                os.makedirs(args.save_corpus, exist_ok=True)
+                with open(os.path.join(args.save_corpus, f'{name}.bin'), 'wb') as f:
+                    f.write(data)
+            run_benchmark(name, split_into_chunks(data, args.chunk_size), args)
+    finally:
+        if args.render:
+            ctx.__exit__()
+        set_options(None)
+
+
+if __name__ == '__main__':
+    main()
@@ -14,6 +14,7 @@
     expand_ansi_c_escapes,
     parse_input_from_terminal,
     strip_csi,
+    test_rewrap_ranges,
     truncate_point_for_length,
     wcswidth,
     wcwidth,
@@ -494,7 +495,151 @@ def test_historybuf(self):
         for i in range(3000):
             self.ae(str(hb.line(i)).rstrip(), str(3000 - 1 - i))
 
-        # rewrap
+        # compression of cold segments
+        hb = HistoryBuf(8 * 2048, 20)
+        lb = LineBuf(1, hb.xnum)
+        line = lb.line(0)
+        for i in range(hb.ynum + 100):
+            line.set_text(str(i).ljust(5), 0, 5, c)
+            hb.push(line)
+        # segments are compressed only once they are cold and the child is idle
+        self.ae(hb.compression_stats()['compressed_segments'], 0)
+        hb.compress_cold_segments()
+        s = hb.compression_stats()
+        self.ae(s['segments'], 8)
+        self.ae(s['compressed_segments'], 4)
+        self.assertGreater(s['saved'], 0)
+        self.ae(s['saved'], s['uncompressed_size'] - s['compressed_size'])
+        self.assertLess(s['compressed_size'] * 10, s['uncompressed_size'])  # plain ASCII lines are stored compactly
+        for i in range(0, hb.ynum, 7):
+            self.ae(str(hb.line(i)).rstrip(), str(hb.ynum + 100 - 1 - i))
+        for i in (1, 3000, 9000, hb.ynum - 1):
+            line.set_text(str(hb.ynum + 100 - 1 - i).ljust(5), 0, 5, c)
+            self.ae(hb.line(i), line)
+        line.set_text('\u00e9', 0, 1, c)
+        hb.push(line)
+        ascii_lb = LineBuf(1, hb.xnum)
+        ascii_line = ascii_lb.line(0)
+        for i in range(4 * 2048):
+            hb.push(ascii_line)
+        self.ae(hb.line(4 * 2048), line)
+        # lines with several runs of colors and attributes
+        runs_lb = LineBuf(1, hb.xnum)
+        runs_line = runs_lb.line(0)
+        c2 = filled_cursor()
+        c2.fg, c2.bold, c2.x = (0x123456 << 8) | 2, True, 3
+        runs_line.set_text('éabc', 0, 4, c)
+        runs_line.set_text('def', 0, 3, c2)
+        c2.x = 12
+        runs_line.set_text('gh', 0, 2, c2)
+        hb.push(runs_line)
+        for i in range(4 * 2048):
+            hb.push(ascii_line)
+        hb.compress_cold_segments()
+        self.assertGreater(hb.compression_stats()['compressed_segments'], 0)
+        self.ae(hb.line(4 * 2048), runs_line)
+        hb2 = HistoryBuf(hb.ynum, hb.xnum)
+        hb.rewrap(hb2)
+        self.ae(hb2.compression_stats()['compressed_segments'], hb.compression_stats()['compressed_segments'])
+        for i in range(0, hb.ynum, 7):
+            self.ae(hb2.line(i), hb.line(i))
+        # spilling of cold segments to disk
+        hb = HistoryBuf(8 * 2048, 20, 0, 1)
+        for i in range(hb.ynum + 100):
+            line.set_text(str(i).ljust(5), 0, 5, c)
+            hb.push(line)
+        hb.compress_cold_segments()
+        s = hb.compression_stats()
+        self.ae(s['spilled_segments'], 4)
+        self.ae(s['compressed_segments'], 0)
+        for i in range(0, hb.ynum, 7):
+            self.ae(str(hb.line(i)).rstrip(), str(hb.ynum + 100 - 1 - i))
+        hb2 = HistoryBuf(hb.ynum, hb.xnum, 0, 1)
+        hb.rewrap(hb2)
+        self.ae(hb2.compression_stats()['spilled_segments'], hb.compression_stats()['spilled_segments'])
+        for i in range(0, hb.ynum, 7):
+            self.ae(hb2.line(i), hb.line(i))
+        # the oldest segment is overwritten while compressed, its lines going to the pager history
+        hb = HistoryBuf(5 * 2048, 20, 1024 * 1024)
+        for i in range(hb.ynum + 5):
+            line.set_text(str(i).ljust(5), 0, 5, c)
+            hb.push(line)
+        hb.compress_cold_segments()
+        for i in range(hb.ynum + 5, hb.ynum + 2048 + 10):
+            line.set_text(str(i).ljust(5), 0, 5, c)
+            hb.push(line)
+            if i == hb.ynum + 1000:
+                for y in (0, 2048 - 1000, hb.ynum - 1):
+                    self.ae(str(hb.line(y)).rstrip(), str(i - y))
+        for y in range(0, hb.ynum, 7):
+            self.ae(str(hb.line(y)).rstrip(), str(hb.ynum + 2048 + 10 - 1 - y))
+        self.ae([x.rstrip().rpartition('m')[2] for x in hb.pagerhist_as_text().splitlines()], [str(i) for i in range(2048 + 10)])
+        # search index
+        hb = HistoryBuf(3 * 2048 + 10, 20)
+        for i in range(hb.ynum + 100):
+            line.clear_text(0, hb.xnum)
+            t = f'Line {i}'
+            line.set_text(t, 0, len(t), c)
+            hb.push(line)
+        first = hb.ynum + 100 - 1
+        self.ae(hb.search('line 5000'), (first - 5000, 0, 8))
+        self.ae(hb.search('ne 5000', first - 5000 + 1), None)
+        self.ae(hb.search('LINE 100'), (first - 1009, 0, 7))  # 1009 is the newest line containing 100
+        self.ae(hb.search('line 100', first - 110, False), (first - 1000, 0, 7))
+        self.ae(hb.search('e 110', first - 1099), (first - 110, 3, 7))  # the oldest lines are in a partly overwritten block
+        self.ae(hb.search('nomatch'), None)
+        hb2 = HistoryBuf(hb.ynum, 10)
+        hb.rewrap(hb2)
+        self.ae(hb2.search('line 5000'), (first - 5000, 0, 8))
+        # lines added after a search clear the blocks they start, so the oldest lines in the
+        # last of these, which is partly overwritten, have to be indexed again
+        for i in range(hb.ynum + 100, hb.ynum + 130):
+            line.clear_text(0, hb.xnum)
+            t = f'Line {i}'
+            line.set_text(t, 0, len(t), c)
+            hb.push(line)
+        last = hb.ynum + 130 - 1
+        for i in range(130, 192):
+            self.ae(hb.search(f'line {i}', hb.count - 1, False), (last - i, 0, len(f'line {i}') - 1))
+        # rewrapping large buffers, which is done in parallel
+        hb = HistoryBuf(16 * 2048, 20)
+        for i in range(8 * 2048):
+            line.clear_text(0, hb.xnum)
+            t = f'{i:08d}line {i % 9}'
+            line.set_text(t, 0, len(t), c)
+            hb.push(line)
+        hb2 = HistoryBuf(hb.ynum, 8)
+        hb.rewrap(hb2)
+        self.ae(hb2.count, 2 * hb.count)
+        self.ae(str(hb2.line(2 * 5000 + 1)), f'{hb.count - 1 - 5000:08d}')
+        # the lines are indexed as they are rewrapped, so searching does not decompress them
+        hb2.compress_cold_segments()
+        compressed = hb2.compression_stats()['compressed_segments']
+        self.assertGreater(compressed, 0)
+        self.ae(hb2.search('nomatch'), None)
+        self.ae(hb2.compression_stats()['compressed_segments'], compressed)
+        self.ae(hb2.search('00004321'), (2 * (hb.count - 1 - 4321) + 1, 0, 7))
+        hb3 = HistoryBuf(hb.ynum, hb.xnum)
+        hb2.rewrap(hb3)
+        self.ae(hb3.count, hb.count)
+        for i in range(0, hb.count, 13):
+            self.ae(hb3.line(i), hb.line(i))
+        # ranges are rewrapped in parallel only with several CPUs, force them so their stitching is tested anyway
+        test_rewrap_ranges(3)
+        try:
+            hb4 = HistoryBuf(hb.ynum, 8)
+            hb.rewrap(hb4)
+            hb5 = HistoryBuf(hb.ynum, hb.xnum)
+            hb4.rewrap(hb5)
+        finally:
+            test_rewrap_ranges(0)
+        self.ae(hb4.count, hb2.count)
+        for i in range(0, hb2.count, 7):
+            self.ae(hb4.line(i), hb2.line(i))
+        self.ae(hb4.search('00004321'), hb2.search('00004321'))
+        self.ae(hb5.count, hb.count)
+        for i in range(0, hb.count, 7):
+            self.ae(hb5.line(i), hb.line(i))
         hb = filled_history_buf(5, 5)
         hb2 = HistoryBuf(hb.ynum, hb.xnum)
         hb.rewrap(hb2)
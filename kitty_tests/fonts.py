@@ -9,7 +9,7 @@
 from functools import partial
 
 from kitty.constants import is_macos, read_kitty_resource
-from kitty.fast_data_types import DECAWM, get_fallback_font, sprite_map_set_layout, sprite_map_set_limits, test_render_line, test_sprite_position_for, wcwidth
+from kitty.fast_data_types import DECAWM, get_fallback_font, shaped_run_cache_info, sprite_map_set_layout, sprite_map_set_limits, test_render_line, test_send_rasterized_sprites, test_sprite_position_for, test_threaded_rasterization, test_update_cell_data, wcwidth
 from kitty.fonts.box_drawing import box_chars
 from kitty.fonts.render import coalesce_symbol_maps, render_string, setup_for_testing, shape_string
 
@@ -59,6 +59,76 @@ def test_box_drawing(self):
         test_render_line(line)
         self.assertEqual(len(self.sprites) - prerendered, len(box_chars))
 
+    def test_cell_data_damage(self):
+        s = self.create_screen(cols=30, lines=10, scrollback=20)
+        buf = bytearray(20 * s.lines * s.columns)
+        self.ae(test_update_cell_data(s, buf), s.lines * s.columns)
+        self.ae(test_update_cell_data(s, buf), 0)
+        s.draw('abc')
+        self.ae(test_update_cell_data(s, buf), 3)
+        full = bytes(buf)
+        s.cursor_position(5, 10)
+        s.draw('x')
+        self.ae(test_update_cell_data(s, buf), 1)
+        self.assertNotEqual(full, buf)
+        for i in range(s.lines):
+            s.index()
+        self.assertGreater(test_update_cell_data(s, buf), 1)
+        s.resize(8, 20)
+        self.ae(test_update_cell_data(s, buf), s.lines * s.columns)
+
+    def render_line(self, text):
+        # the sprites of the cells of text, rendered as a line of a screen
+        s = self.create_screen(cols=20, lines=1, scrollback=0)
+        s.draw(text)
+        line = s.line(0)
+        test_render_line(line)
+        return [line.sprite_at(x) for x in range(len(text))]
+
+    def test_shaped_run_cache(self):
+        render = self.render_line
+        shaped_run_cache_info(True)
+        first = render('$ ls -l café')
+        self.ae(shaped_run_cache_info()['hits'], 0)
+        self.assertGreater(shaped_run_cache_info()['misses'], 0)
+        self.ae(render('$ ls -l café'), first)
+        self.assertGreater(shaped_run_cache_info()['hits'], 0)
+        second = render('$ ls -a café')
+        self.assertNotEqual(second, first)
+        self.ae(second[:5], first[:5])
+
+    def test_ascii_runs(self):
+        render = self.render_line
+        prerendered = len(self.sprites)
+        ascii = render('a=b==c')
+        self.ae(len(self.sprites) - prerendered, 4)
+        self.ae(ascii[3], ascii[4])
+        # runs with non-ASCII text are always shaped, they must use the same sprites
+        self.ae(render('a=b==c\xe9')[:6], ascii)
+        self.ae(render('c==b=a'), ascii[::-1])
+
+    def test_threaded_rasterization(self):
+        if not test_threaded_rasterization(True):
+            test_threaded_rasterization(False)
+            self.skipTest('Glyphs cannot be rasterized on other threads with this font')
+        try:
+            text = 'xyz\u2260'
+            prerendered = len(self.sprites)
+            s = self.create_screen(cols=10, lines=1, scrollback=0)
+            s.draw(text)
+            line = s.line(0)
+            test_render_line(line)
+            # the sprites are assigned at once but only uploaded by the main thread
+            keys = [line.sprite_at(x) for x in range(len(text))]
+            self.ae(len(set(keys)), len(text))
+            self.ae(len(self.sprites), prerendered)
+            test_send_rasterized_sprites()
+            self.ae(len(self.sprites), prerendered + len(text))
+            threaded = [self.sprites[k] for k in keys]
+        finally:
+            test_threaded_rasterization(False)
+        self.ae(threaded, render_string(text)[-1])
+
     def test_font_rendering(self):
         render_string('ab\u0347\u0305你好|\U0001F601|\U0001F64f|\U0001F63a|')
         text = 'He\u0347\u0305llo\u0341, w\u0302or\u0306l\u0354d!'
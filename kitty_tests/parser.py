@@ -72,6 +72,15 @@ def test_simple_parsing(self):
         pb('ニチ ', 'ニチ ')
         self.ae(str(s.line(4)), 'ニチ ')
 
+        s = self.create_screen()
+        pb = partial(self.parse_bytes_dump, s)
+        q = 'abcdefghijklmnopqrstuvwxyz'
+        pb(q, q)
+        self.ae(tuple(map(str, (s.line(i) for i in range(s.lines)))), ('fghij', 'klmno', 'pqrst', 'uvwxy', 'z'))
+        pb(b'\rx\xe2\x82', ('screen_carriage_return',), 'x')
+        pb(b'\xacyz\x07', '€yz', ('screen_bell',))
+        self.ae(str(s.line(4)), 'x€yz')
+
     def test_esc_codes(self):
         s = self.create_screen()
         pb = partial(self.parse_bytes_dump, s)
@@ -87,6 +96,8 @@ def test_charsets(self):
         pb = partial(self.parse_bytes_dump, s)
         pb(b'\xc3')
         pb(b'\xa1', ('draw', b'\xc3\xa1'.decode('utf-8')))
+        pb(b'a\xffb\xe4\xb8', 'ab')
+        pb(b'\xad\xc3(c\xed\xa0\x80d\xc2\x9b1m', '中(cd', ('select_graphic_rendition', '1 '))
         s = self.create_screen()
         pb = partial(self.parse_bytes_dump, s)
         pb('\033)0\x0e/_', ('screen_designate_charset', 1, ord('0')), ('screen_change_charset', 1), '/_')
@@ -486,3 +497,24 @@ def test_deccara(self):
             line = s.line(y)
             for x in range(s.columns):
                 self.ae(line.cursor_from(x).fg, (10 << 8 | 1) if x < 1 or x > 2 else (4 << 8) | 1)
+
+    def test_pty_recording(self):
+        from kitty.pty_recording import MAGIC, chunks_for_window, iter_chunks
+
+        def varint(x):
+            ans = bytearray()
+            while True:
+                b, x = x & 0x7f, x >> 7
+                ans.append(b | (0x80 if x else 0))
+                if not x:
+                    return bytes(ans)
+
+        def chunk(delay, window_id, data):
+            return varint(delay) + varint(window_id) + varint(len(data)) + data
+
+        rec = MAGIC + chunk(5, 3, b'abc') + chunk(300, 7, b'x' * 200) + chunk(1 << 40, 3, b'\x1b[m') + chunk(2, 3, b'truncated')[:-3]
+        self.ae([(c.delay, c.window_id, bytes(c.data)) for c in iter_chunks(rec)], [
+            (5, 3, b'abc'), (300, 7, b'x' * 200), (1 << 40, 3, b'\x1b[m'), (2, 3, b'trunca')])
+        self.ae([(c.delay, bytes(c.data)) for c in chunks_for_window(rec)], [(5, b'abc'), (300 + (1 << 40), b'\x1b[m'), (2, b'trunca')])
+        self.ae([(c.delay, bytes(c.data)) for c in chunks_for_window(rec, 7)], [(305, b'x' * 200)])
+        self.assertRaises(ValueError, lambda: list(iter_chunks(b'not a recording')))
@@ -1,7 +1,7 @@
 #!/usr/bin/env python
 # License: GPL v3 Copyright: 2016, Kovid Goyal <kovid at kovidgoyal.net>
 
-from kitty.fast_data_types import DECAWM, DECCOLM, DECOM, IRM, Cursor, parse_bytes
+from kitty.fast_data_types import DECAWM, DECCOLM, DECOM, IRM, Cursor, HistoryBuf, LineBuf, parse_bytes
 from kitty.marks import marker_from_function, marker_from_regex
 from kitty.window import pagerhist
 
@@ -38,6 +38,16 @@ def test_draw_fast(self):
         self.ae(str(s.line(0)), '0123b')
         self.ae(s.cursor.x, 5), self.ae(s.cursor.y, 0)
 
+        # Now test runs mixing simple and special characters
+        s.reset(), s.reset_dirty()
+        s.cursor.bold = True
+        s.draw('abcd中éf')
+        self.ae(str(s.line(0)), 'abcd')
+        self.ae(str(s.line(1)), '中éf')
+        self.ae((s.cursor.x, s.cursor.y), (4, 1))
+        self.assertTrue(s.line(0).cursor_from(3).bold)
+        self.assertTrue(s.line(1).cursor_from(3).bold)
+
         # Now test in insert mode
         s.reset(), s.reset_dirty()
         s.set_mode(IRM)
@@ -305,6 +315,45 @@ def test_resize(self):
         s.resize(s.lines, s.columns + 4)
         self.ae(str(s.linebuf), 'xxx\nxx\nbb\n\n')
 
+    def test_lazy_history_rewrap(self):
+        s = self.create_screen(cols=10, lines=5, scrollback=60)
+        for i in range(80):
+            s.draw(f'{i}:' + 'x' * (i % 23) + ' ' * (i % 4)), s.carriage_return(), s.linefeed()
+
+        def rewrapped(hb, xnum, lazily):
+            ans = HistoryBuf(hb.ynum, xnum)
+            hb.rewrap(ans, lazily)
+            return ans
+
+        eager = rewrapped(s.historybuf, 10, False)
+        lazy = rewrapped(s.historybuf, 10, False)
+        for xnum in (7, 3, 13, 30):
+            eager, lazy = rewrapped(eager, xnum, False), rewrapped(lazy, xnum, True)
+            self.ae(lazy.count, eager.count)
+            lb = LineBuf(1, xnum)
+            # some of the lines that have yet to be rewrapped scroll off
+            for i in range(xnum):
+                lb.line(0).set_text(f'p{i}'[:xnum], 0, min(xnum, len(f'p{i}')), Cursor())
+                eager.push(lb.line(0)), lazy.push(lb.line(0))
+            self.ae(lazy.count, eager.count)
+        self.ae(str(lazy), str(eager))
+        self.ae(lazy.search('62:x'), eager.search('62:x'))
+
+        def draw_prompts(s):
+            for i in range(20):
+                parse_bytes(s, b'\033]133;A\007')
+                s.draw(f'$ {i}'), s.carriage_return(), s.index()
+                s.draw('out ' * (i % 7)), s.carriage_return(), s.index()
+        s, ref = self.create_screen(cols=20, lines=5, scrollback=100), self.create_screen(cols=20, lines=5, scrollback=100)
+        draw_prompts(s), draw_prompts(ref)
+        for xnum in (7, 13, 20):
+            s.resize(5, xnum), ref.resize(5, xnum)
+            ref.historybuf.line(ref.historybuf.count - 1)  # rewrap all lines now
+        self.ae(str(s.historybuf), str(ref.historybuf))
+        for n in (-3, -12, 2, 4):
+            self.assertTrue(s.scroll_to_prompt(n)), self.assertTrue(ref.scroll_to_prompt(n))
+            self.ae(str(s.visual_line(0)), str(ref.visual_line(0)))
+
     def test_cursor_after_resize(self):
 
         def draw(text, end_line=True):
@@ -672,6 +721,33 @@ def test_wrapping_serialization(self):
         s.draw('a😀')
         self.ae(as_text(s), 'a😀')
 
+    def test_scrollback_for_pager(self):
+        import tempfile
+
+        from kitty.window import as_text
+
+        def ae(s):
+            expected = as_text(s, as_ansi=True, add_history=True, add_wrap_markers=True).replace('\r\n', '\n').replace('\r', '\n')
+            with tempfile.TemporaryFile() as f:
+                num_lines = s.write_scrollback_for_pager(f.fileno())
+                f.seek(0)
+                self.ae(f.read().decode('utf-8'), expected)
+            self.ae(num_lines, expected.count('\n'))
+
+        s = self.create_screen(cols=4, lines=3, scrollback=5, options={'scrollback_pager_history_size': 128})
+        ae(s)
+        for i in range(12):
+            s.select_graphic_rendition(31 + i % 6)
+            s.draw(f'{i}😀' + 'x' * (i % 6))
+            if i % 3:
+                s.carriage_return(), s.linefeed()
+        ae(s)
+        parse_bytes(s, b'\x1b]8;;moo\x1b\\link')
+        ae(s)
+        s.toggle_alt_screen()
+        s.draw('alt')
+        ae(s)
+
     def test_pagerhist(self):
         hsz = 8
         s = self.create_screen(cols=2, lines=2, scrollback=2, options={'scrollback_pager_history_size': hsz})
@@ -705,6 +781,22 @@ def test():
         s.draw('8' * s.columns), line(4), test()
         s.draw('9' * s.columns), line(5), test()
 
+        from kitty.window import as_text
+
+        def scrolled_off(read_after_every_line):
+            # lines are converted to text lazily, check that gives the same result as converting them one at a time
+            s = self.create_screen(cols=4, lines=2, scrollback=2, options={'scrollback_pager_history_size': 64})
+            for i in range(40):
+                parse_bytes(s, f'\x1b[3{i % 8}m{i:04d}'.encode())
+                if i == 21:
+                    parse_bytes(s, b'\x1b]8;;moo\x1b\\link\x1b]8;;\x1b\\')
+                if i % 3:
+                    parse_bytes(s, b'\r\n')
+                if read_after_every_line:
+                    contents()
+            return s.historybuf.pagerhist_as_text(), as_text(s, as_ansi=True, add_history=True)
+        self.ae(scrolled_off(False), scrolled_off(True))
+
         s = self.create_screen(options={'scrollback_pager_history_size': 2048})
         text = '\x1b[msoft\r\x1b[mbreak\nnext😼cat'
         w(text)
@@ -712,6 +804,18 @@ def test():
         s.historybuf.pagerhist_rewrap(2)
         self.ae(contents(), '\x1b[mso\rft\x1b[m\rbr\rea\rk\nne\rxt\r😼\rca\rt')
 
+        # text larger than the chunks it is stored in
+        s = self.create_screen(options={'scrollback_pager_history_size': 100000})
+        text = ''.join(f'{i}😼\n' for i in range(30000))
+        for i in range(0, len(text), 10000):
+            w(text[i:i+10000] if i % 20000 else text[i:i+10000].encode())
+        expected = text.encode()[-100000:].decode('utf-8', 'ignore')
+        self.ae(contents(), expected)
+        s.historybuf.pagerhist_rewrap(3)
+        rewrapped = contents()
+        self.assertIn('\r', rewrapped)
+        self.assertTrue(expected.endswith(rewrapped.replace('\r', '')))
+
         s = self.create_screen(options={'scrollback_pager_history_size': 8})
         w('😼')
         self.ae(contents(), '😼')
@@ -781,6 +885,25 @@ def mark_x(text):
         s.set_marker(marker_from_function(mark_x))
         self.ae(s.marked_cells(), [(2, 0, 1), (4, 0, 2)])
 
+    def test_search_scrollback(self):
+        s = self.create_screen(cols=20, lines=5, scrollback=20)
+        for i in range(25):
+            s.draw(f'🐈 item {i} {"even" if i % 2 == 0 else "odd"}')
+            s.carriage_return(), s.linefeed()
+        self.assertTrue(s.search_scrollback('ITEM 1 '))
+        self.ae(s.scrolled_by, 21 - 1)
+        self.ae(s.text_for_selection(), ('item 1 ',))
+        self.assertFalse(s.search_scrollback('item 1 '))
+        for i in (2, 4, 6):
+            self.assertTrue(s.search_scrollback('even', False))
+            self.ae(s.scrolled_by, 21 - i)
+            self.ae(s.text_for_selection(), ('even',))
+        self.assertTrue(s.search_scrollback('3 odd'))
+        self.ae(s.scrolled_by, 21 - 3)
+        self.assertFalse(s.search_scrollback('item 20'))
+        s.toggle_alt_screen()
+        self.assertFalse(s.search_scrollback('item'))
+
     def test_hyperlinks(self):
         s = self.create_screen()
         self.ae(s.line(0).hyperlink_ids(), tuple(0 for x in range(s.columns)))